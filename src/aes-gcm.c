@@ -0,0 +1,440 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt")
+#endif
+
+// ------------------------------------------------------------
+// AES-256-GCM kernels
+// Payload encryption (see "Payload encryption" in engine.c) runs
+// the message through gcmBlocks kernels: CTR encryption and the
+// GHASH of the ciphertext in one pass over a chunk. Chunks are
+// hashed independently and chained afterwards (gcmCombine), so
+// they can be processed on several threads and in whatever
+// portions the embedding needs them.
+//
+// The portable kernel uses lookup tables (T-tables for AES, 4 bit
+// tables for GHASH), which are not constant time; the AES-NI /
+// PCLMULQDQ kernel is used whenever the CPU has them.
+// ------------------------------------------------------------
+#define GCM_KEY_BYTES 32
+#define GCM_NONCE_BYTES 12
+#define GCM_TAG_BYTES 16
+#define AES_ROUNDS 14
+
+struct gcmKey {
+    unsigned char roundKeys[AES_ROUNDS + 1][16]; // FIPS-197 byte order (as AES-NI wants them)
+    uint32_t roundWords[4 * (AES_ROUNDS + 1)];    // the same as big endian words
+    unsigned char h[16];                          // hash key E(0)
+    uint64_t tableHigh[16], tableLow[16];         // h times every 4 bit value
+    unsigned char hPowers[4][16];                 // h^1..h^4 byte reversed (PCLMULQDQ kernel)
+};
+
+// counter = first counter block (its last 32 bits count, big endian);
+// the GHASH of the ciphertext (input when decrypting) is added to
+// `hash`, a partial last block padded with zeros
+typedef void (*gcmBlocksFn)(const struct gcmKey *key, const unsigned char counter[16], const unsigned char *in,
+                            unsigned char *out, size_t length, int decrypt, unsigned char hash[16]);
+
+static const unsigned char aesSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static uint32_t aesTable[4][256]; // SubBytes + MixColumns per input byte position
+static int aesTableReady;
+
+static inline uint32_t aesGetU32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void aesPutU32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+static void aesTablesInit(void) {
+    if (aesTableReady) return;
+    for (int x = 0; x < 256; x++) {
+        uint32_t s = aesSbox[x];
+        uint32_t s2 = ((s << 1) ^ (s & 0x80 ? 0x1B : 0)) & 0xFF;
+        uint32_t word = (s2 << 24) | (s << 16) | (s << 8) | (s2 ^ s);
+        for (int t = 0; t < 4; t++) {
+            aesTable[t][x] = word;
+            word = (word >> 8) | (word << 24);
+        }
+    }
+    aesTableReady = 1;
+}
+
+static void aesEncryptPortable(const struct gcmKey *key, const unsigned char in[16], unsigned char out[16]) {
+    const uint32_t *rk = key->roundWords;
+    uint32_t s0 = aesGetU32(in) ^ rk[0], s1 = aesGetU32(in + 4) ^ rk[1];
+    uint32_t s2 = aesGetU32(in + 8) ^ rk[2], s3 = aesGetU32(in + 12) ^ rk[3];
+
+    for (int round = 1; round < AES_ROUNDS; round++) {
+        rk += 4;
+        uint32_t t0 = aesTable[0][s0 >> 24] ^ aesTable[1][(s1 >> 16) & 0xFF] ^ aesTable[2][(s2 >> 8) & 0xFF] ^
+                      aesTable[3][s3 & 0xFF] ^ rk[0];
+        uint32_t t1 = aesTable[0][s1 >> 24] ^ aesTable[1][(s2 >> 16) & 0xFF] ^ aesTable[2][(s3 >> 8) & 0xFF] ^
+                      aesTable[3][s0 & 0xFF] ^ rk[1];
+        uint32_t t2 = aesTable[0][s2 >> 24] ^ aesTable[1][(s3 >> 16) & 0xFF] ^ aesTable[2][(s0 >> 8) & 0xFF] ^
+                      aesTable[3][s1 & 0xFF] ^ rk[2];
+        uint32_t t3 = aesTable[0][s3 >> 24] ^ aesTable[1][(s0 >> 16) & 0xFF] ^ aesTable[2][(s1 >> 8) & 0xFF] ^
+                      aesTable[3][s2 & 0xFF] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    // last round without MixColumns
+    rk += 4;
+    uint32_t state[4] = { s0, s1, s2, s3 };
+    for (int c = 0; c < 4; c++) {
+        uint32_t word = ((uint32_t)aesSbox[state[c] >> 24] << 24) |
+                        ((uint32_t)aesSbox[(state[(c + 1) & 3] >> 16) & 0xFF] << 16) |
+                        ((uint32_t)aesSbox[(state[(c + 2) & 3] >> 8) & 0xFF] << 8) |
+                        aesSbox[state[(c + 3) & 3] & 0xFF];
+        aesPutU32(out + 4 * c, word ^ rk[c]);
+    }
+}
+
+// ------------------------------------------------------------
+// GHASH arithmetic in GCM's bit order (bit 0 = MSB of byte 0),
+// values as two big endian halves
+// ------------------------------------------------------------
+static inline uint64_t gcmGetU64(const unsigned char *p) {
+    return ((uint64_t)aesGetU32(p) << 32) | aesGetU32(p + 4);
+}
+
+static inline void gcmPutU64(unsigned char *p, uint64_t value) {
+    aesPutU32(p, (uint32_t)(value >> 32));
+    aesPutU32(p + 4, (uint32_t)value);
+}
+
+// x = x * y, bit by bit (for the few multiplications outside the kernels)
+static void gcmMultiply(unsigned char x[16], const unsigned char y[16]) {
+    uint64_t zHigh = 0, zLow = 0;
+    uint64_t vHigh = gcmGetU64(y), vLow = gcmGetU64(y + 8);
+
+    for (int i = 0; i < 128; i++) {
+        if ((x[i / 8] >> (7 - i % 8)) & 1) {
+            zHigh ^= vHigh;
+            zLow ^= vLow;
+        }
+        uint64_t carry = vLow & 1;
+        vLow = (vLow >> 1) | (vHigh << 63);
+        vHigh = (vHigh >> 1) ^ (carry ? 0xE100000000000000ULL : 0);
+    }
+    gcmPutU64(x, zHigh);
+    gcmPutU64(x + 8, zLow);
+}
+
+// h^blocks, for chaining the hashes of independent pieces
+void gcmPower(const struct gcmKey *key, uint64_t blocks, unsigned char power[16]) {
+    unsigned char base[16];
+    memset(power, 0, 16);
+    power[0] = 0x80; // 1 in GCM's bit order
+    memcpy(base, key->h, 16);
+    for (; blocks > 0; blocks >>= 1) {
+        if (blocks & 1) gcmMultiply(power, base);
+        gcmMultiply(base, base);
+    }
+}
+
+// GHASH of A followed by B from the hash of each on its own:
+// hash = hash * h^(blocks of B) + second
+void gcmCombine(unsigned char hash[16], const unsigned char power[16], const unsigned char second[16]) {
+    gcmMultiply(hash, power);
+    for (int i = 0; i < 16; i++) hash[i] ^= second[i];
+}
+
+static const uint64_t gcmReduce4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+// x = x * h with the 4 bit tables (Shoup's method)
+static void gcmMultiplyH(const struct gcmKey *key, unsigned char x[16]) {
+    int low = x[15] & 0xF;
+    uint64_t zHigh = key->tableHigh[low], zLow = key->tableLow[low];
+
+    for (int i = 15; i >= 0; i--) {
+        int nibbles[2] = { x[i] & 0xF, x[i] >> 4 };
+        for (int n = i == 15 ? 1 : 0; n < 2; n++) {
+            int rem = (int)(zLow & 0xF);
+            zLow = (zHigh << 60) | (zLow >> 4);
+            zHigh = (zHigh >> 4) ^ (gcmReduce4[rem] << 48);
+            zHigh ^= key->tableHigh[nibbles[n]];
+            zLow ^= key->tableLow[nibbles[n]];
+        }
+    }
+    gcmPutU64(x, zHigh);
+    gcmPutU64(x + 8, zLow);
+}
+
+static inline void gcmCounterAdd(unsigned char block[16], const unsigned char counter[16], uint32_t add) {
+    memcpy(block, counter, 12);
+    aesPutU32(block + 12, aesGetU32(counter + 12) + add);
+}
+
+static void gcmBlocksPortable(const struct gcmKey *key, const unsigned char counter[16], const unsigned char *in,
+                              unsigned char *out, size_t length, int decrypt, unsigned char hash[16]) {
+    unsigned char block[16], stream[16];
+    for (size_t pos = 0, b = 0; pos < length; pos += 16, b++) {
+        size_t n = length - pos < 16 ? length - pos : 16;
+        if (decrypt) {
+            for (size_t i = 0; i < n; i++) hash[i] ^= in[pos + i];
+        }
+        gcmCounterAdd(block, counter, (uint32_t)b);
+        aesEncryptPortable(key, block, stream);
+        for (size_t i = 0; i < n; i++) out[pos + i] = in[pos + i] ^ stream[i];
+        if (!decrypt) {
+            for (size_t i = 0; i < n; i++) hash[i] ^= out[pos + i];
+        }
+        gcmMultiplyH(key, hash);
+    }
+}
+
+#ifdef CPU_X86
+// ------------------------------------------------------------
+// AES-NI / PCLMULQDQ kernel
+// Eight counter blocks are in flight at once. GHASH works on byte
+// reversed values (Intel's carry-less multiplication white paper):
+// four blocks are multiplied by h^4..h^1, the 256 bit products
+// summed up and reduced once.
+// ------------------------------------------------------------
+__attribute__((target("sse4.1,aes,pclmul")))
+static inline __m128i gcmReverse(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// Unreduced 256 bit carry-less product, added to (*low, *high)
+__attribute__((target("sse4.1,aes,pclmul")))
+static inline void gcmClmulAdd(__m128i a, __m128i b, __m128i *low, __m128i *middle, __m128i *high) {
+    *low = _mm_xor_si128(*low, _mm_clmulepi64_si128(a, b, 0x00));
+    *high = _mm_xor_si128(*high, _mm_clmulepi64_si128(a, b, 0x11));
+    *middle = _mm_xor_si128(*middle, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01)));
+}
+
+// Shift left by one (the bit reflection) and reduce modulo x^128 + x^7 + x^2 + x + 1
+__attribute__((target("sse4.1,aes,pclmul")))
+static inline __m128i gcmReduce(__m128i low, __m128i middle, __m128i high) {
+    low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+    high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+    __m128i carryLow = _mm_srli_epi32(low, 31), carryHigh = _mm_srli_epi32(high, 31);
+    low = _mm_slli_epi32(low, 1);
+    high = _mm_slli_epi32(high, 1);
+    high = _mm_or_si128(high, _mm_srli_si128(carryLow, 12));
+    high = _mm_or_si128(high, _mm_slli_si128(carryHigh, 4));
+    low = _mm_or_si128(low, _mm_slli_si128(carryLow, 4));
+
+    __m128i t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+    __m128i spill = _mm_srli_si128(t, 4);
+    low = _mm_xor_si128(low, _mm_slli_si128(t, 12));
+    t = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+    t = _mm_xor_si128(t, spill);
+    return _mm_xor_si128(high, _mm_xor_si128(low, t));
+}
+
+__attribute__((target("sse4.1,aes,pclmul")))
+static inline __m128i gcmMultiplyClmul(__m128i a, __m128i b) {
+    __m128i low = _mm_setzero_si128(), middle = low, high = low;
+    gcmClmulAdd(a, b, &low, &middle, &high);
+    return gcmReduce(low, middle, high);
+}
+
+// h^2..h^4 for the aggregated reduction
+__attribute__((target("sse4.1,aes,pclmul")))
+static void gcmPowersClmul(struct gcmKey *key) {
+    __m128i h = gcmReverse(_mm_loadu_si128((const __m128i *)key->h));
+    __m128i power = h;
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)key->hPowers[i], power);
+        power = gcmMultiplyClmul(power, h);
+    }
+}
+
+__attribute__((target("sse4.1,aes,pclmul")))
+static void gcmBlocksAesni(const struct gcmKey *key, const unsigned char counter[16], const unsigned char *in,
+                           unsigned char *out, size_t length, int decrypt, unsigned char hash[16]) {
+    __m128i rk[AES_ROUNDS + 1];
+    for (int r = 0; r <= AES_ROUNDS; r++) rk[r] = _mm_loadu_si128((const __m128i *)key->roundKeys[r]);
+    __m128i h1 = _mm_loadu_si128((const __m128i *)key->hPowers[0]);
+    __m128i h2 = _mm_loadu_si128((const __m128i *)key->hPowers[1]);
+    __m128i h3 = _mm_loadu_si128((const __m128i *)key->hPowers[2]);
+    __m128i h4 = _mm_loadu_si128((const __m128i *)key->hPowers[3]);
+
+    // counter in host order in the last lane, byte swapped back per block
+    const __m128i swapCounter = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 15, 14, 13, 12);
+    __m128i ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)counter), swapCounter);
+    __m128i x = gcmReverse(_mm_loadu_si128((const __m128i *)hash));
+    size_t pos = 0;
+
+    for (; pos + 128 <= length; pos += 128) {
+        __m128i b0 = _mm_shuffle_epi8(ctr, swapCounter);
+        __m128i b1 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 1)), swapCounter);
+        __m128i b2 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 2)), swapCounter);
+        __m128i b3 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 3)), swapCounter);
+        __m128i b4 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 4)), swapCounter);
+        __m128i b5 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 5)), swapCounter);
+        __m128i b6 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 6)), swapCounter);
+        __m128i b7 = _mm_shuffle_epi8(_mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 7)), swapCounter);
+        ctr = _mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 8));
+
+        // written out: the eight blocks have to stay in registers
+        b0 = _mm_xor_si128(b0, rk[0]); b1 = _mm_xor_si128(b1, rk[0]);
+        b2 = _mm_xor_si128(b2, rk[0]); b3 = _mm_xor_si128(b3, rk[0]);
+        b4 = _mm_xor_si128(b4, rk[0]); b5 = _mm_xor_si128(b5, rk[0]);
+        b6 = _mm_xor_si128(b6, rk[0]); b7 = _mm_xor_si128(b7, rk[0]);
+        for (int r = 1; r < AES_ROUNDS; r++) {
+            __m128i k = rk[r];
+            b0 = _mm_aesenc_si128(b0, k); b1 = _mm_aesenc_si128(b1, k);
+            b2 = _mm_aesenc_si128(b2, k); b3 = _mm_aesenc_si128(b3, k);
+            b4 = _mm_aesenc_si128(b4, k); b5 = _mm_aesenc_si128(b5, k);
+            b6 = _mm_aesenc_si128(b6, k); b7 = _mm_aesenc_si128(b7, k);
+        }
+        __m128i last = rk[AES_ROUNDS];
+        __m128i d0 = _mm_loadu_si128((const __m128i *)(in + pos)), d1 = _mm_loadu_si128((const __m128i *)(in + pos + 16));
+        __m128i d2 = _mm_loadu_si128((const __m128i *)(in + pos + 32)), d3 = _mm_loadu_si128((const __m128i *)(in + pos + 48));
+        __m128i d4 = _mm_loadu_si128((const __m128i *)(in + pos + 64)), d5 = _mm_loadu_si128((const __m128i *)(in + pos + 80));
+        __m128i d6 = _mm_loadu_si128((const __m128i *)(in + pos + 96)), d7 = _mm_loadu_si128((const __m128i *)(in + pos + 112));
+        b0 = _mm_xor_si128(_mm_aesenclast_si128(b0, last), d0); b1 = _mm_xor_si128(_mm_aesenclast_si128(b1, last), d1);
+        b2 = _mm_xor_si128(_mm_aesenclast_si128(b2, last), d2); b3 = _mm_xor_si128(_mm_aesenclast_si128(b3, last), d3);
+        b4 = _mm_xor_si128(_mm_aesenclast_si128(b4, last), d4); b5 = _mm_xor_si128(_mm_aesenclast_si128(b5, last), d5);
+        b6 = _mm_xor_si128(_mm_aesenclast_si128(b6, last), d6); b7 = _mm_xor_si128(_mm_aesenclast_si128(b7, last), d7);
+        _mm_storeu_si128((__m128i *)(out + pos), b0); _mm_storeu_si128((__m128i *)(out + pos + 16), b1);
+        _mm_storeu_si128((__m128i *)(out + pos + 32), b2); _mm_storeu_si128((__m128i *)(out + pos + 48), b3);
+        _mm_storeu_si128((__m128i *)(out + pos + 64), b4); _mm_storeu_si128((__m128i *)(out + pos + 80), b5);
+        _mm_storeu_si128((__m128i *)(out + pos + 96), b6); _mm_storeu_si128((__m128i *)(out + pos + 112), b7);
+        if (decrypt) {
+            b0 = d0; b1 = d1; b2 = d2; b3 = d3; b4 = d4; b5 = d5; b6 = d6; b7 = d7;
+        }
+
+        __m128i low = _mm_setzero_si128(), middle = low, high = low;
+        gcmClmulAdd(_mm_xor_si128(x, gcmReverse(b0)), h4, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b1), h3, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b2), h2, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b3), h1, &low, &middle, &high);
+        x = gcmReduce(low, middle, high);
+        low = middle = high = _mm_setzero_si128();
+        gcmClmulAdd(_mm_xor_si128(x, gcmReverse(b4)), h4, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b5), h3, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b6), h2, &low, &middle, &high);
+        gcmClmulAdd(gcmReverse(b7), h1, &low, &middle, &high);
+        x = gcmReduce(low, middle, high);
+    }
+
+    // the rest one block at a time, the last one padded
+    for (; pos < length; pos += 16) {
+        size_t n = length - pos < 16 ? length - pos : 16;
+        unsigned char data[16] = { 0 }, result[16] = { 0 };
+        memcpy(data, in + pos, n);
+
+        __m128i block = _mm_xor_si128(_mm_shuffle_epi8(ctr, swapCounter), rk[0]);
+        ctr = _mm_add_epi32(ctr, _mm_setr_epi32(0, 0, 0, 1));
+        for (int r = 1; r < AES_ROUNDS; r++) block = _mm_aesenc_si128(block, rk[r]);
+        block = _mm_xor_si128(_mm_aesenclast_si128(block, rk[AES_ROUNDS]), _mm_loadu_si128((const __m128i *)data));
+        _mm_storeu_si128((__m128i *)result, block);
+        memset(result + n, 0, 16 - n);
+        memcpy(out + pos, result, n);
+
+        __m128i cipher = gcmReverse(_mm_loadu_si128((const __m128i *)(decrypt ? data : result)));
+        x = gcmMultiplyClmul(_mm_xor_si128(x, cipher), h1);
+    }
+    _mm_storeu_si128((__m128i *)hash, gcmReverse(x));
+}
+#endif
+
+// ------------------------------------------------------------
+// Function: gcmKeyInit
+// Purpose : AES-256 key schedule, hash key and the tables of both
+//           kernels
+// ------------------------------------------------------------
+void gcmKeyInit(struct gcmKey *key, const unsigned char secret[GCM_KEY_BYTES], int clmul) {
+    static const unsigned char rcon[7] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40 };
+    uint32_t *w = key->roundWords;
+
+    aesTablesInit();
+    for (int i = 0; i < 8; i++) w[i] = aesGetU32(secret + 4 * i);
+    for (int i = 8; i < 4 * (AES_ROUNDS + 1); i++) {
+        uint32_t t = w[i - 1];
+        if (i % 8 == 0) {
+            t = (t << 8) | (t >> 24);
+            t = ((uint32_t)aesSbox[t >> 24] << 24) | ((uint32_t)aesSbox[(t >> 16) & 0xFF] << 16) |
+                ((uint32_t)aesSbox[(t >> 8) & 0xFF] << 8) | aesSbox[t & 0xFF];
+            t ^= (uint32_t)rcon[i / 8 - 1] << 24;
+        } else if (i % 8 == 4) {
+            t = ((uint32_t)aesSbox[t >> 24] << 24) | ((uint32_t)aesSbox[(t >> 16) & 0xFF] << 16) |
+                ((uint32_t)aesSbox[(t >> 8) & 0xFF] << 8) | aesSbox[t & 0xFF];
+        }
+        w[i] = w[i - 8] ^ t;
+    }
+    for (int i = 0; i < 4 * (AES_ROUNDS + 1); i++) aesPutU32(key->roundKeys[i / 4] + 4 * (i % 4), w[i]);
+
+    unsigned char zero[16] = { 0 };
+    aesEncryptPortable(key, zero, key->h);
+
+    // tables for the portable kernel: h times 8, 4, 2, 1, then all sums
+    uint64_t vHigh = gcmGetU64(key->h), vLow = gcmGetU64(key->h + 8);
+    key->tableHigh[0] = key->tableLow[0] = 0;
+    key->tableHigh[8] = vHigh;
+    key->tableLow[8] = vLow;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t carry = vLow & 1;
+        vLow = (vLow >> 1) | (vHigh << 63);
+        vHigh = (vHigh >> 1) ^ (carry ? 0xE100000000000000ULL : 0);
+        key->tableHigh[i] = vHigh;
+        key->tableLow[i] = vLow;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            key->tableHigh[i + j] = key->tableHigh[i] ^ key->tableHigh[j];
+            key->tableLow[i + j] = key->tableLow[i] ^ key->tableLow[j];
+        }
+    }
+
+#ifdef CPU_X86
+    if (clmul) gcmPowersClmul(key);
+#else
+    (void)clmul;
+#endif
+}
+
+// Encrypts one block with the portable code (the tag mask E(J0))
+void gcmEncryptBlock(const struct gcmKey *key, const unsigned char in[16], unsigned char out[16]) {
+    aesEncryptPortable(key, in, out);
+}
+
+// Fills buf with bytes from the system's random generator; returns 0 on success
+int gcmRandom(unsigned char *buf, size_t length) {
+#ifdef _WIN32
+    return BCryptGenRandom(NULL, buf, (ULONG)length, BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0 ? 0 : -1;
+#else
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (!f) return -1;
+    size_t got = fread(buf, 1, length, f);
+    fclose(f);
+    return got == length ? 0 : -1;
+#endif
+}
@@ -15,6 +15,7 @@ struct option {
     char shorthand;
     char *description;
     char *value;
+    bool flag; // option without value, e.g. --in-place
 };
 
 struct command {
@@ -37,10 +38,27 @@ struct command {
     int optionCount;
 
     int(*run)(struct command *cmd);
+
+    // runs before the command itself or any of its subcommands is run
+    int(*persistentPreRun)(struct command *cmd);
 };
 
 void printHelp(struct command *cmd);
 
+// runs the persistent pre-run hooks of all parents first, then the one of cmd
+static int runPersistentPreRun(struct command *cmd) {
+    if (cmd == NULL) {
+        return 0;
+    }
+
+    int result = runPersistentPreRun(cmd->parent);
+    if (result != 0 || cmd->persistentPreRun == NULL) {
+        return result;
+    }
+
+    return cmd->persistentPreRun(cmd);
+}
+
 int executeCommand(struct command cmd, int argc, char **argv, const int offsetI) {
     int foundArguments = 0;
 
@@ -52,7 +70,7 @@ int executeCommand(struct command cmd, int argc, char **argv, const int offsetI)
         for (int j = 0; j < cmd.subcommandCount; j++) {
             if (strcmp(cmd.subcommands[j].name, arg) == 0) {
                 // subcommand found - continue by parsing the subcommand
-                return executeCommand(cmd.subcommands[j], argc, argv, offsetI + 1);
+                return executeCommand(cmd.subcommands[j], argc, argv, i + 1);
             }
         }
 
@@ -64,16 +82,6 @@ int executeCommand(struct command cmd, int argc, char **argv, const int offsetI)
                 return 0;
             }
 
-            // verify value is provided
-            if (i + 1 >= argc) {
-                printf("missing value for option %s\n", arg);
-                return -1;
-            }
-
-            // get the value for the option (the argument provided next, after the option's name)
-            // TODO allow using --option=value?
-            char *value = argv[i + 1];
-
             bool found = false;
 
             for (int j = 0; j < cmd.optionCount; j++) {
@@ -82,12 +90,27 @@ int executeCommand(struct command cmd, int argc, char **argv, const int offsetI)
                 found = (arg[1] == opt->shorthand) ||
                     (strlen(arg) >= 3 && arg[1] == '-' && strcmp(&arg[2], opt->name) == 0);
 
-                // apply the option's value and stop searching
-                if (found) {
-                    opt->value = value;
-                    i++;
+                if (!found) {
+                    continue;
+                }
+
+                // flags don't take a value, their presence is enough
+                if (opt->flag) {
+                    opt->value = "true";
                     break;
                 }
+
+                // verify value is provided
+                if (i + 1 >= argc) {
+                    printf("missing value for option %s\n", arg);
+                    return -1;
+                }
+
+                // apply the option's value (the argument provided next, after the option's name)
+                // TODO allow using --option=value?
+                opt->value = argv[i + 1];
+                i++;
+                break;
             }
 
             if (found) {
@@ -123,6 +146,12 @@ int executeCommand(struct command cmd, int argc, char **argv, const int offsetI)
 
     // run the parsed command
     if (cmd.run) {
+        // persistent hooks from the root down (parent options are parsed by now)
+        int result = runPersistentPreRun(&cmd);
+        if (result != 0) {
+            return result;
+        }
+
         return cmd.run(&cmd);
     }
 
@@ -165,6 +194,10 @@ int getOptionInt(struct command *cmd, char *name) {
     return (int)strtol(value, NULL, 10);
 }
 
+bool getOptionFlag(struct command *cmd, char *name) {
+    return getOption(cmd, name) != NULL;
+}
+
 char *fullCommandPath(struct command *cmd) {
     if (cmd->parent == NULL) {
         return strdup(cmd->name);
@@ -277,9 +310,13 @@ void printHelp(struct command *cmd) {
     }
 
     for (int i = 0; i < cmd->optionCount; i++) {
+        if (cmd->options[i].shorthand) {
+            printf("\t-%c, ", cmd->options[i].shorthand);
+        } else {
+            printf("\t    ");
+        }
         printf(
-            "\t-%c, --%-*s  %s\n",
-            cmd->options[i].shorthand,
+            "--%-*s  %s\n",
             maxLen,
             cmd->options[i].name,
             cmd->options[i].description ?: ""
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CPU_X86 1
+#endif
+
+// ------------------------------------------------------------
+// Instruction set levels we ship kernels for. Every level implies
+// the ones below it, so a kernel table can fall back step by step.
+// ------------------------------------------------------------
+enum isa {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,     // AVX2 + BMI2
+    ISA_AVX512BW, // AVX-512 F + BW + BMI2
+    ISA_COUNT
+};
+
+static const char *isaNames[ISA_COUNT] = { "scalar", "sse2", "avx2", "avx512bw" };
+
+#ifdef CPU_X86
+// Reads the XCR0 register, which tells whether the OS saves the wide registers
+static unsigned long long cpuXgetbv(void) {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+}
+#endif
+
+// ------------------------------------------------------------
+// Function: cpuDetectIsa
+// Purpose : Probes CPUID (and the OS register state via XGETBV)
+//           for the best instruction set this machine can run
+// ------------------------------------------------------------
+int cpuDetectIsa(void) {
+#ifdef CPU_X86
+    unsigned int eax, ebx, ecx, edx;
+    int level = ISA_SSE2; // part of the x86-64 baseline
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return level;
+
+    int osxsave = (ecx & bit_OSXSAVE) != 0;
+    int avx = (ecx & bit_AVX) != 0;
+    if (!osxsave || !avx) return level;
+
+    unsigned long long xcr0 = cpuXgetbv();
+    if ((xcr0 & 0x6) != 0x6) return level; // XMM + YMM state
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return level;
+
+    int bmi2 = (ebx & bit_BMI2) != 0;
+    if ((ebx & bit_AVX2) && bmi2) level = ISA_AVX2;
+    else return level;
+
+    int avx512 = (ebx & bit_AVX512F) && (ebx & bit_AVX512BW);
+    if (avx512 && (xcr0 & 0xE0) == 0xE0) level = ISA_AVX512BW; // opmask + ZMM state
+
+    return level;
+#else
+    return ISA_SCALAR;
+#endif
+}
+
+// Returns the ISA level for a name like "avx2", or -1 if unknown
+int cpuParseIsa(const char *name) {
+    for (int i = 0; i < ISA_COUNT; i++) {
+        if (strcasecmp(name, isaNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// AES-NI and PCLMULQDQ (with SSSE3 / SSE4.1), independent of the ISA level
+int cpuHasAesClmul(void) {
+#ifdef CPU_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & bit_AES) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+#else
+    return 0;
+#endif
+}
+
+// SSSE3 (pshufb), which the sse2 level doesn't guarantee
+int cpuHasSsse3(void) {
+#ifdef CPU_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & bit_SSSE3) != 0;
+#else
+    return 0;
+#endif
+}
+
+// SSE4.2 (crc32), which the sse2 level doesn't guarantee
+int cpuHasSse42(void) {
+#ifdef CPU_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & bit_SSE4_2) != 0;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,127 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78)
+// Used as the payload checksum. Same conventions as zlib's crc32():
+// start with 0, feed the data in any number of pieces.
+//
+// The SSE4.2 crc32 instruction has a latency of three cycles but can
+// start one every cycle, so the kernel runs three independent CRCs
+// over three adjacent lanes and merges them: the CRC of A followed by
+// B is the CRC of A shifted over len(B) zero bytes, XOR the CRC of B
+// started from zero. Shifting over a fixed length is linear, so it
+// is four table lookups (crc32cLong / crc32cShort).
+// ------------------------------------------------------------
+#define CRC32C_POLY 0x82F63B78
+#define CRC32C_LONG 8192 // lane length for large blocks
+#define CRC32C_SHORT 256 // lane length for the rest
+
+typedef uint32_t (*crc32cFn)(uint32_t crc, const unsigned char *data, size_t length);
+
+static uint32_t crc32cTable[8][256];  // slicing by 8
+static uint32_t crc32cLong[4][256];   // shift over CRC32C_LONG zero bytes
+static uint32_t crc32cShort[4][256];  // shift over CRC32C_SHORT zero bytes
+
+// a * b modulo the polynomial (bit 31 = x^0)
+static uint32_t crc32cMultiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+        if (a & m) product ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+// x^(8 * bytes) modulo the polynomial
+static uint32_t crc32cPower(uint64_t bytes) {
+    uint32_t result = 1u << 31, square = 1u << 23; // x^0, x^8
+    for (; bytes > 0; bytes >>= 1) {
+        if (bytes & 1) result = crc32cMultiply(result, square);
+        square = crc32cMultiply(square, square);
+    }
+    return result;
+}
+
+static void crc32cShiftTable(uint32_t table[4][256], uint32_t power) {
+    for (int k = 0; k < 4; k++) {
+        for (uint32_t b = 0; b < 256; b++) table[k][b] = crc32cMultiply(power, b << (8 * k));
+    }
+}
+
+static void crc32cInit(void) {
+    if (crc32cTable[0][1] != 0) return;
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32cTable[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++) crc32cTable[k][n] = (crc32cTable[k - 1][n] >> 8) ^ crc32cTable[0][crc32cTable[k - 1][n] & 0xFF];
+    }
+    crc32cShiftTable(crc32cLong, crc32cPower(CRC32C_LONG));
+    crc32cShiftTable(crc32cShort, crc32cPower(CRC32C_SHORT));
+}
+
+// ------------------------------------------------------------
+// Function: crc32cCombine
+// Purpose : CRC of A followed by B from crc(A), crc(B) and len(B)
+// ------------------------------------------------------------
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+    return crc32cMultiply(crc32cPower(lengthB), crcA) ^ crcB;
+}
+
+static uint32_t crc32cPortable(uint32_t crc, const unsigned char *data, size_t length) {
+    crc = ~crc;
+    for (; length > 0 && ((uintptr_t)data & 7) != 0; length--) crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *data++) & 0xFF];
+    for (; length >= 8; length -= 8, data += 8) {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+        crc = crc32cTable[7][low & 0xFF] ^ crc32cTable[6][(low >> 8) & 0xFF] ^ crc32cTable[5][(low >> 16) & 0xFF] ^
+              crc32cTable[4][low >> 24] ^ crc32cTable[3][data[4]] ^ crc32cTable[2][data[5]] ^ crc32cTable[1][data[6]] ^
+              crc32cTable[0][data[7]];
+    }
+    for (; length > 0; length--) crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *data++) & 0xFF];
+    return ~crc;
+}
+
+#ifdef CPU_X86
+static inline uint64_t crc32cLoad(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline uint32_t crc32cShift(uint32_t table[4][256], uint32_t crc) {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const unsigned char *data, size_t length) {
+    uint64_t crc0 = ~crc;
+    for (; length > 0 && ((uintptr_t)data & 7) != 0; length--) crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+
+    // three lanes at a time, first long ones, then short ones
+    static const size_t lanes[2] = { CRC32C_LONG, CRC32C_SHORT };
+    for (int size = 0; size < 2; size++) {
+        const size_t lane = lanes[size];
+        while (length >= 3 * lane) {
+            uint64_t crc1 = 0, crc2 = 0;
+            for (const unsigned char *end = data + lane; data < end; data += 8) {
+                crc0 = _mm_crc32_u64(crc0, crc32cLoad(data));
+                crc1 = _mm_crc32_u64(crc1, crc32cLoad(data + lane));
+                crc2 = _mm_crc32_u64(crc2, crc32cLoad(data + 2 * lane));
+            }
+            uint32_t (*shift)[256] = size == 0 ? crc32cLong : crc32cShort;
+            crc0 = crc32cShift(shift, (uint32_t)crc0) ^ (uint32_t)crc1;
+            crc0 = crc32cShift(shift, (uint32_t)crc0) ^ (uint32_t)crc2;
+            data += 2 * lane;
+            length -= 3 * lane;
+        }
+    }
+
+    for (; length >= 8; length -= 8, data += 8) crc0 = _mm_crc32_u64(crc0, crc32cLoad(data));
+    for (; length > 0; length--) crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+    return ~(uint32_t)crc0;
+}
+#endif
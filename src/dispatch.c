@@ -0,0 +1,96 @@
+#include <stdio.h>
+
+// ------------------------------------------------------------
+// Kernel dispatch
+// All pixel kernels are called through this table. It is filled
+// once at startup for the best ISA the CPU supports and can be
+// overridden with the global --force-isa option for benchmarking.
+// ------------------------------------------------------------
+struct kernels {
+    int isa;
+    lsbEmbedFn lsbEmbed;
+    lsbExtractFn lsbExtract;
+    pngScoreFn pngScore;
+    pngUnfilterFn pngUnfilter;
+    gcmBlocksFn gcmBlocks;
+    rsEncodeFn rsEncode;
+    crc32cFn crc32c;
+};
+
+struct kernels kernels;
+
+// Fills the kernel table for the given ISA level
+static void bindKernels(int isa) {
+    kernels.isa = isa;
+
+    switch (isa) {
+#ifdef CPU_X86
+    case ISA_AVX512BW:
+        kernels.lsbEmbed = lsbEmbedAvx512;
+        kernels.lsbExtract = lsbExtractAvx512;
+        kernels.pngScore = pngScoreAvx512;
+        kernels.pngUnfilter = pngUnfilterAvx2;
+        kernels.gcmBlocks = cpuHasAesClmul() ? gcmBlocksAesni : gcmBlocksPortable;
+        kernels.rsEncode = rsEncodeAvx512;
+        kernels.crc32c = cpuHasSse42() ? crc32cSse42 : crc32cPortable;
+        break;
+    case ISA_AVX2:
+        kernels.lsbEmbed = lsbEmbedAvx2;
+        kernels.lsbExtract = lsbExtractAvx2;
+        kernels.pngScore = pngScoreAvx2;
+        kernels.pngUnfilter = pngUnfilterAvx2;
+        kernels.gcmBlocks = cpuHasAesClmul() ? gcmBlocksAesni : gcmBlocksPortable;
+        kernels.rsEncode = rsEncodeAvx2;
+        kernels.crc32c = cpuHasSse42() ? crc32cSse42 : crc32cPortable;
+        break;
+    case ISA_SSE2:
+        kernels.lsbEmbed = lsbEmbedSse2;
+        kernels.lsbExtract = lsbExtractSse2;
+        kernels.pngScore = pngScoreSse2;
+        kernels.pngUnfilter = pngUnfilterSse2;
+        kernels.gcmBlocks = cpuHasAesClmul() ? gcmBlocksAesni : gcmBlocksPortable;
+        kernels.rsEncode = cpuHasSsse3() ? rsEncodeSsse3 : rsEncodeScalar;
+        kernels.crc32c = cpuHasSse42() ? crc32cSse42 : crc32cPortable;
+        break;
+#endif
+    default:
+        kernels.isa = ISA_SCALAR;
+        kernels.lsbEmbed = lsbEmbedScalar;
+        kernels.lsbExtract = lsbExtractScalar;
+        kernels.pngScore = pngScoreScalar;
+        kernels.pngUnfilter = pngUnfilterScalar;
+        kernels.gcmBlocks = gcmBlocksPortable;
+        kernels.rsEncode = rsEncodeScalar;
+        kernels.crc32c = crc32cPortable;
+        break;
+    }
+}
+
+// ------------------------------------------------------------
+// Function: initKernels
+// Purpose : Binds the kernels for the detected CPU, or for the
+//           forced ISA if one is given (NULL = autodetect)
+// Returns : 0 on success, -1 if the forced ISA can't be used
+// ------------------------------------------------------------
+int initKernels(const char *forceIsa) {
+    int best = cpuDetectIsa();
+    crc32cInit();
+
+    if (forceIsa == NULL) {
+        bindKernels(best);
+        return 0;
+    }
+
+    int isa = cpuParseIsa(forceIsa);
+    if (isa < 0) {
+        printf("Unknown ISA \"%s\" (use scalar, sse2, avx2 or avx512bw).\n", forceIsa);
+        return -1;
+    }
+    if (isa > best) {
+        printf("ISA \"%s\" is not supported by this CPU (best: %s).\n", forceIsa, isaNames[best]);
+        return -1;
+    }
+
+    bindKernels(isa);
+    return 0;
+}
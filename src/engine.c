@@ -0,0 +1,1273 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// Embedding engine
+// Every image format describes its pixel buffer with a
+// pixelGeometry and lets the engine move bits in and out of it.
+// The geometry is validated once in geometryInit(), so the loops
+// below hand whole row segments to the kernels without any
+// per-bit bounds checks.
+//
+// Slots are numbered in embedding order: row by row (following
+// `stride`, which may be negative for bottom-up walks), and inside
+// a row pixel by pixel over the channels selected in channelMask.
+// ------------------------------------------------------------
+#define GEOMETRY_GENERIC 2 // any channel mask the kernels have no layout for
+
+struct pixelGeometry {
+    unsigned char *firstRow; // row holding the first slots
+    long long stride;        // bytes from one row to the next in embedding order
+    long long width;         // pixels per row
+    long long height;        // number of rows
+    int channels;            // bytes per pixel
+    int channelMask;         // bit i set = channel i carries payload bits
+
+    // derived by geometryInit
+    int layout;              // LSB_PACKED, LSB_RGBA or GEOMETRY_GENERIC
+    int usedChannels;
+    int channelOffset[8];    // byte offset of the n-th used channel in a pixel
+    size_t rowSlots;
+    size_t totalSlots;
+};
+
+// ------------------------------------------------------------
+// Function: geometryInit
+// Purpose : Validates the geometry of a pixel buffer and derives
+//           the slot layout used by the embed / extract loops
+// Returns : 0 on success, -1 if the geometry is unusable
+// ------------------------------------------------------------
+int geometryInit(struct pixelGeometry *g, unsigned char *firstRow, long long stride,
+                 long long width, long long height, int channels, int channelMask) {
+    memset(g, 0, sizeof(*g));
+
+    if (firstRow == NULL || width <= 0 || height <= 0 || channels < 1 || channels > 8) return -1;
+    if (channelMask <= 0 || channelMask >= (1 << channels)) return -1;
+
+    long long rowBytes = width * channels;
+    if (width > INT32_MAX || height > INT32_MAX || llabs(stride) < rowBytes) return -1;
+
+    g->firstRow = firstRow;
+    g->stride = stride;
+    g->width = width;
+    g->height = height;
+    g->channels = channels;
+    g->channelMask = channelMask;
+
+    for (int c = 0; c < channels; c++) {
+        if (channelMask & (1 << c)) {
+            g->channelOffset[g->usedChannels++] = c;
+        }
+    }
+
+    if (g->usedChannels == channels) {
+        g->layout = LSB_PACKED;
+    } else if (channels == 4 && channelMask == 0x7) {
+        g->layout = LSB_RGBA;
+    } else {
+        g->layout = GEOMETRY_GENERIC;
+    }
+
+    g->rowSlots = (size_t)width * g->usedChannels;
+    g->totalSlots = g->rowSlots * (size_t)height;
+    return 0;
+}
+
+static inline unsigned char *geometryRow(const struct pixelGeometry *g, size_t y) {
+    return g->firstRow + (ptrdiff_t)y * g->stride;
+}
+
+// Scalar fallback for channel masks without a kernel layout
+static void geometryGenericRun(const struct pixelGeometry *g, unsigned char *row, size_t slot, size_t count,
+                               unsigned char *stream, size_t bitPos, int embed) {
+    for (size_t i = 0; i < count; i++, slot++, bitPos++) {
+        unsigned char *p = row + slot / g->usedChannels * g->channels + g->channelOffset[slot % g->usedChannels];
+        unsigned char mask = (unsigned char)(1 << (bitPos & 7));
+
+        if (embed) {
+            *p = (*p & 0xFE) | ((stream[bitPos >> 3] & mask) != 0);
+        } else {
+            stream[bitPos >> 3] = (*p & 1) ? (stream[bitPos >> 3] | mask) : (stream[bitPos >> 3] & ~mask);
+        }
+    }
+}
+
+// Walks the slots [firstSlot, firstSlot + nBits) row by row
+static int geometryRun(const struct pixelGeometry *g, size_t firstSlot, unsigned char *stream,
+                       size_t bitPos, size_t nBits, int embed) {
+    if (firstSlot > g->totalSlots || nBits > g->totalSlots - firstSlot) return -1;
+
+    size_t y = firstSlot / g->rowSlots;
+    size_t slot = firstSlot % g->rowSlots;
+
+    while (nBits > 0) {
+        size_t count = g->rowSlots - slot;
+        if (count > nBits) count = nBits;
+
+        unsigned char *row = geometryRow(g, y);
+        if (g->layout == GEOMETRY_GENERIC) {
+            geometryGenericRun(g, row, slot, count, stream, bitPos, embed);
+        } else if (embed) {
+            kernels.lsbEmbed(row, g->layout, slot, count, stream, bitPos);
+        } else {
+            kernels.lsbExtract(row, g->layout, slot, count, stream, bitPos);
+        }
+
+        bitPos += count;
+        nBits -= count;
+        slot = 0;
+        y++;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Row bands
+// Where a slot lives is a pure function of the geometry, so a slot
+// range can be cut into bands that start on row boundaries and be
+// embedded by several threads at once: every band knows its first
+// stream bit (band start - firstSlot) and no two bands share a row.
+// ------------------------------------------------------------
+#define GEOMETRY_BAND_SLOTS (1 << 20) // smallest band worth a thread
+
+struct geometryBands {
+    const struct pixelGeometry *g;
+    size_t firstSlot;
+    unsigned char *stream;
+    size_t bitPos;
+    size_t nBits;
+};
+
+// First slot of band `index` (index == count gives the end)
+static size_t geometryBandStart(const struct geometryBands *b, int index, int count) {
+    size_t end = b->firstSlot + b->nBits;
+    if (index == 0) return b->firstSlot;
+    if (index == count) return end;
+
+    size_t slot = b->firstSlot + b->nBits / count * index;
+    size_t rowSlots = b->g->rowSlots;
+    slot = (slot + rowSlots - 1) / rowSlots * rowSlots; // round up to the next row start
+    return slot < end ? slot : end;
+}
+
+static void geometryEmbedBand(void *ctx, int index, int count) {
+    const struct geometryBands *b = ctx;
+    size_t begin = geometryBandStart(b, index, count);
+    size_t end = geometryBandStart(b, index + 1, count);
+
+    geometryRun(b->g, begin, b->stream, b->bitPos + (begin - b->firstSlot), end - begin, 1);
+}
+
+// Extraction is split by output bytes instead: the kernels update the
+// stream with 64 bit read-modify-writes, so each part gathers into a
+// buffer of its own and copies whole bytes into the stream.
+#define GEOMETRY_GATHER_BYTES (64 << 10)
+
+static void geometryExtractBand(void *ctx, int index, int count) {
+    const struct geometryBands *b = ctx;
+    unsigned char buffer[GEOMETRY_GATHER_BYTES + LSB_STREAM_PADDING];
+    size_t bytes = b->nBits / 8;
+    size_t begin = bytes / count * index;
+    size_t end = index == count - 1 ? bytes : bytes / count * (index + 1);
+
+    for (size_t pos = begin; pos < end;) {
+        size_t n = end - pos < GEOMETRY_GATHER_BYTES ? end - pos : GEOMETRY_GATHER_BYTES;
+        geometryRun(b->g, b->firstSlot + pos * 8, buffer, 0, n * 8, 0);
+        memcpy(b->stream + b->bitPos / 8 + pos, buffer, n);
+        pos += n;
+    }
+}
+
+// Reads nBits slot LSBs (starting at firstSlot) into the stream at bitPos
+int geometryExtractBits(const struct pixelGeometry *g, size_t firstSlot, unsigned char *stream,
+                        size_t bitPos, size_t nBits) {
+    if (firstSlot > g->totalSlots || nBits > g->totalSlots - firstSlot) return -1;
+
+    // only byte aligned targets can be split into whole bytes
+    int parts = bitPos % 8 == 0 ? threadsFor(nBits, GEOMETRY_BAND_SLOTS) : 1;
+    if (parts <= 1) return geometryRun(g, firstSlot, stream, bitPos, nBits, 0);
+
+    struct geometryBands bands = { g, firstSlot, stream, bitPos, nBits };
+    parallelRun(parts, geometryExtractBand, &bands);
+
+    size_t whole = nBits / 8 * 8; // a trailing partial byte is done here
+    return geometryRun(g, firstSlot + whole, stream, bitPos + whole, nBits - whole, 0);
+}
+
+// Writes nBits stream bits (from bitPos on) into the slots starting at firstSlot
+int geometryEmbedBits(const struct pixelGeometry *g, size_t firstSlot, const unsigned char *stream,
+                      size_t bitPos, size_t nBits) {
+    if (firstSlot > g->totalSlots || nBits > g->totalSlots - firstSlot) return -1;
+
+    struct geometryBands bands = { g, firstSlot, (unsigned char *)stream, bitPos, nBits };
+    parallelRun(threadsFor(nBits, GEOMETRY_BAND_SLOTS), geometryEmbedBand, &bands);
+    return 0;
+}
+
+
+// ------------------------------------------------------------
+// Payload bit stream
+// Layout (version 3, all little endian):
+//   bytes 0-2   "Stg", the magic
+//   byte 3      0xFF, marks a versioned header
+//   byte 4      version (3)
+//   byte 5      flags (PAYLOAD_FLAG_*, unknown bits are rejected)
+//   bytes 6-11  length of the stored bytes (48 bit)
+//   bytes 12-15 CRC32C of bytes 0-11
+//   followed by the stored bytes, which end in a CRC32C trailer over
+//   them, started from the header CRC (payloadStoredLength).
+// An image without a payload fails the magic after 32 bits and the
+// header CRC after 128, instead of yielding a random "message".
+//
+// Earlier layouts are still read (unless --strict):
+//   version 2: byte 0 = 2, byte 1 flags, byte 2 = 0, byte 3 = 0xFF,
+//              bytes 4-11 length (64 bit), no checksums
+//   legacy:    a bare 32 bit length. Those were capped far below
+//              2^24 bytes, so their 4th byte is never 0xFF.
+// All of them can be told apart from the first 32 bits.
+//
+// Stream buffers always carry LSB_STREAM_PADDING spare bytes so the
+// kernels can read and write whole words at the end.
+// ------------------------------------------------------------
+#define PAYLOAD_VERSION 3
+#define PAYLOAD_MARKER 0xFF
+#define PAYLOAD_LEGACY_BITS 32  // bare 32 bit length
+#define PAYLOAD_V2_BITS 96      // version 2 header
+#define PAYLOAD_HEADER_BITS 128 // current header
+#define PAYLOAD_V2_BYTES (PAYLOAD_V2_BITS / 8)
+#define PAYLOAD_HEADER_BYTES (PAYLOAD_HEADER_BITS / 8)
+#define PAYLOAD_CRC_BYTES 4     // CRC32C trailer
+
+#define PAYLOAD_FLAG_DEFLATE 0x01 // message is compressed (see payloadCompress)
+#define PAYLOAD_FLAG_AES_GCM 0x02 // message is encrypted (see payloadKeySet)
+#define PAYLOAD_FLAG_RS 0x04      // message carries error correction (see payloadFecSet)
+#define PAYLOAD_FLAGS_KNOWN (PAYLOAD_FLAG_DEFLATE | PAYLOAD_FLAG_AES_GCM | PAYLOAD_FLAG_RS)
+#define PAYLOAD_CHECKED 0x100     // not stored: version 3, the stored bytes end in a CRC32C trailer
+
+static const unsigned char payloadMagic[3] = { 'S', 't', 'g' };
+
+int payloadStrict = 0; // 1 = only accept version 3 headers (extract --strict)
+
+struct payloadHeader {
+    int version;        // 1 = legacy 32 bit length
+    int flags;          // PAYLOAD_FLAG_*, plus PAYLOAD_CHECKED for version 3
+    size_t headerBits;  // slots taken by the header
+    uint64_t length;    // stored bytes
+};
+
+unsigned char *streamAlloc(size_t bytes) {
+    return calloc(bytes + LSB_STREAM_PADDING, 1);
+}
+
+static inline void streamPutU32(unsigned char *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint32_t streamGetU32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void streamPutU64(unsigned char *p, uint64_t value) {
+    streamPutU32(p, (uint32_t)value);
+    streamPutU32(p + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint64_t streamGetU64(const unsigned char *p) {
+    return streamGetU32(p) | ((uint64_t)streamGetU32(p + 4) << 32);
+}
+
+// Largest message (in bytes) that fits into the given number of slots
+size_t payloadCapacitySlots(size_t totalSlots) {
+    if (totalSlots < PAYLOAD_HEADER_BITS) return 0;
+    return (totalSlots - PAYLOAD_HEADER_BITS) / 8;
+}
+
+// Largest plain message (in bytes) for the given number of slots, as
+// `capacity` reports it: the CRC32C trailer comes off as well
+size_t payloadMessageCapacity(size_t totalSlots) {
+    size_t stored = payloadCapacitySlots(totalSlots);
+    return stored > PAYLOAD_CRC_BYTES ? stored - PAYLOAD_CRC_BYTES : 0;
+}
+
+size_t payloadCapacity(const struct pixelGeometry *g) {
+    return payloadCapacitySlots(g->totalSlots);
+}
+
+// Fills in the header for `stored` bytes; returns its CRC, where the trailer CRC starts
+uint32_t payloadPutHeader(unsigned char *header, uint64_t stored, int flags) {
+    memcpy(header, payloadMagic, 3);
+    header[3] = PAYLOAD_MARKER;
+    header[4] = PAYLOAD_VERSION;
+    header[5] = (unsigned char)flags;
+    for (int i = 0; i < 6; i++) header[6 + i] = (unsigned char)(stored >> (8 * i));
+
+    uint32_t crc = kernels.crc32c(0, header, 12);
+    streamPutU32(header + 12, crc);
+    return crc;
+}
+
+// Version 2 header; encryption still authenticates this one (payloadSealStart)
+static void payloadPutHeaderV2(unsigned char *header, uint64_t length, int flags) {
+    header[0] = 2;
+    header[1] = (unsigned char)flags;
+    header[2] = 0;
+    header[3] = PAYLOAD_MARKER;
+    streamPutU64(header + 4, length);
+}
+
+// Size of the header in slots, judged by its first 32 bits
+size_t payloadHeaderBits(const unsigned char *first) {
+    if (first[3] != PAYLOAD_MARKER) return PAYLOAD_LEGACY_BITS;
+    return memcmp(first, payloadMagic, 3) == 0 ? PAYLOAD_HEADER_BITS : PAYLOAD_V2_BITS;
+}
+
+// ------------------------------------------------------------
+// Function: payloadParseHeader
+// Purpose : Decodes a header of any version (payloadHeaderBits()
+//           bits must be present) and checks that the message fits
+//           into totalSlots
+// Returns : 0 if the header is valid (version 3) or plausible
+//           (older ones), -1 otherwise
+// ------------------------------------------------------------
+int payloadParseHeader(const unsigned char *header, size_t totalSlots, struct payloadHeader *h) {
+    memset(h, 0, sizeof(*h));
+    h->headerBits = payloadHeaderBits(header);
+
+    if (h->headerBits == PAYLOAD_HEADER_BITS) {
+        h->version = header[4];
+        h->flags = header[5] | PAYLOAD_CHECKED;
+        for (int i = 0; i < 6; i++) h->length |= (uint64_t)header[6 + i] << (8 * i);
+        if (streamGetU32(header + 12) != kernels.crc32c(0, header, 12) || h->version != PAYLOAD_VERSION ||
+            (header[5] & ~PAYLOAD_FLAGS_KNOWN) != 0 || h->length < PAYLOAD_CRC_BYTES) {
+            return -1;
+        }
+    } else if (payloadStrict) {
+        return -1;
+    } else if (h->headerBits == PAYLOAD_LEGACY_BITS) {
+        h->version = 1;
+        h->length = streamGetU32(header);
+    } else {
+        h->version = header[0];
+        h->flags = header[1];
+        h->length = streamGetU64(header + 4);
+        if (h->version != 2 || (h->flags & ~PAYLOAD_FLAGS_KNOWN) != 0 || header[2] != 0) return -1;
+    }
+
+    if (h->length == 0 || totalSlots < h->headerBits) return -1;
+    if (h->length > (totalSlots - h->headerBits) / 8) return -1;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Payload checksum
+// CRC32C over the stored bytes on the worker threads: every part is
+// checked on its own and the results are chained with
+// crc32cCombine. Error correction, if any, wraps the trailer too.
+// ------------------------------------------------------------
+#define PAYLOAD_CRC_PART (4 << 20)
+
+struct payloadCrcJob {
+    const unsigned char *data;
+    size_t length;
+    int partCount;
+    uint32_t *crcs;
+};
+
+static void payloadCrcPart(void *ctx, int index, int count) {
+    struct payloadCrcJob *job = ctx;
+    for (int p = index; p < job->partCount; p += count) {
+        size_t offset = (size_t)p * PAYLOAD_CRC_PART;
+        size_t n = job->length - offset < PAYLOAD_CRC_PART ? job->length - offset : PAYLOAD_CRC_PART;
+        job->crcs[p] = kernels.crc32c(0, job->data + offset, n);
+    }
+}
+
+// Continues crc over `length` bytes
+static uint32_t payloadCrc(uint32_t crc, const unsigned char *data, size_t length) {
+    struct payloadCrcJob job = { data, length, (int)((length + PAYLOAD_CRC_PART - 1) / PAYLOAD_CRC_PART), NULL };
+    if (job.partCount <= 1 || threadsFor(length, PAYLOAD_CRC_PART) <= 1 || !(job.crcs = malloc(job.partCount * sizeof(uint32_t)))) {
+        return kernels.crc32c(crc, data, length);
+    }
+
+    parallelRun(threadsFor(length, PAYLOAD_CRC_PART), payloadCrcPart, &job);
+    for (int p = 0; p < job.partCount; p++) {
+        size_t n = length - (size_t)p * PAYLOAD_CRC_PART < PAYLOAD_CRC_PART ? length - (size_t)p * PAYLOAD_CRC_PART : PAYLOAD_CRC_PART;
+        crc = crc32cCombine(crc, job.crcs[p], n);
+    }
+    free(job.crcs);
+    return crc;
+}
+
+// Checks and strips the CRC32C trailer of a message with a version 3
+// header of `stored` bytes; 0 if it matches, -1 otherwise (*message freed, NULL)
+static int payloadVerify(int flags, uint64_t stored, unsigned char **message, size_t *msgLen) {
+    unsigned char header[PAYLOAD_HEADER_BYTES];
+    uint32_t crc = payloadPutHeader(header, stored, flags & 0xFF);
+
+    if (*msgLen >= PAYLOAD_CRC_BYTES) {
+        size_t length = *msgLen - PAYLOAD_CRC_BYTES;
+        if (payloadCrc(crc, *message, length) == streamGetU32(*message + length)) {
+            (*message)[length] = '\0';
+            *msgLen = length;
+            return 0;
+        }
+    }
+    printf("Checksum mismatch, the content is damaged.\n");
+    free(*message);
+    *message = NULL;
+    return -1;
+}
+
+// ------------------------------------------------------------
+// Payload error correction (embed --fec)
+// With PAYLOAD_FLAG_RS the stored bytes (compressed / encrypted
+// already) carry a Reed-Solomon code, so a few flipped LSBs (a
+// palette quantizer, a retouched spot) are repaired on extraction
+// instead of breaking the message:
+//   27 bytes     parity bytes per codeword (8 bit) and protected
+//                length (64 bit), three copies (bitwise majority)
+//   rows * C     the protected bytes, zero padded
+//   nsym * C     parity
+// Codeword i is byte i of every row (C codewords of rows + nsym <=
+// 255 bytes). That interleaves them, so a burst of damaged bytes is
+// spread over all codewords, and it lets kernels.rsEncode work on
+// whole rows, in column blocks on the worker threads. Extraction
+// re-encodes the same way and only decodes codewords whose parity
+// doesn't match. The payload header itself isn't covered.
+// ------------------------------------------------------------
+#define PAYLOAD_FEC_FIELDS 9
+#define PAYLOAD_FEC_HEADER (3 * PAYLOAD_FEC_FIELDS)
+#define PAYLOAD_FEC_COLUMNS 1024 // codewords per block, keeps the working rows in cache
+
+static int payloadParity = 0; // parity bytes per codeword, 0 = no --fec
+
+// Codewords and data rows for `length` protected bytes
+static void fecLayout(size_t length, int nsym, size_t *codewords, size_t *rows) {
+    size_t perCodeword = 255 - (size_t)nsym;
+    *codewords = length > 0 ? (length - 1) / perCodeword + 1 : 1;
+    *rows = (length + *codewords - 1) / *codewords;
+}
+
+static size_t fecStoredLength(size_t length, int nsym) {
+    size_t codewords, rows;
+    fecLayout(length, nsym, &codewords, &rows);
+    return PAYLOAD_FEC_HEADER + codewords * (rows + (size_t)nsym);
+}
+
+// Parity bytes per codeword for a redundancy in percent: nsym parity
+// bytes per 255 - nsym data bytes, an even number
+static int payloadParityFor(double percent) {
+    int nsym = 2 * (int)ceil(255 * percent / (100 + percent) / 2);
+    return nsym < RS_MAX_PARITY ? nsym : RS_MAX_PARITY;
+}
+
+// ------------------------------------------------------------
+// Function: payloadFecSet
+// Purpose : Applies a --fec value: the redundancy in percent of the
+//           protected bytes (1 to 100, "%" optional)
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int payloadFecSet(const char *value) {
+    char *end;
+    double percent = strtod(value, &end);
+    if (*end == '%') end++;
+    if (end == value || *end != '\0' || !(percent >= 1 && percent <= 100)) {
+        printf("Invalid redundancy \"%s\" (use 1 to 100 percent).\n", value);
+        return -1;
+    }
+
+    payloadParity = payloadParityFor(percent);
+    printf("Error correction: %d parity bytes per codeword (up to 255 bytes), repairs up to %d damaged bytes in each.\n",
+           payloadParity, payloadParity / 2);
+    return 0;
+}
+
+struct fecJob {
+    unsigned char *data;               // first row
+    size_t codewords, rows;            // rows: data rows
+    int nsym;
+    int blockCount;
+    unsigned char tables[RS_MAX_PARITY][32];
+    atomic_size_t corrected;
+    atomic_int failed;
+};
+
+static void fecEncodePart(void *ctx, int index, int count) {
+    struct fecJob *job = ctx;
+    const size_t stride = job->codewords;
+
+    for (int b = index; b < job->blockCount; b += count) {
+        size_t first = (size_t)b * PAYLOAD_FEC_COLUMNS;
+        size_t width = stride - first < PAYLOAD_FEC_COLUMNS ? stride - first : PAYLOAD_FEC_COLUMNS;
+        kernels.rsEncode(job->tables, job->nsym, job->data + first, stride, job->rows,
+                         job->data + job->rows * stride + first, stride, width);
+    }
+}
+
+// Re-encodes a column block; codewords whose parity differs from the
+// recomputed one go through the scalar decoder
+static void fecDecodePart(void *ctx, int index, int count) {
+    struct fecJob *job = ctx;
+    const size_t stride = job->codewords;
+    const int nsym = job->nsym, n = (int)job->rows + nsym;
+    unsigned char *remainders = malloc((size_t)nsym * PAYLOAD_FEC_COLUMNS);
+    unsigned char dirty[PAYLOAD_FEC_COLUMNS];
+    if (!remainders) {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+
+    for (int b = index; b < job->blockCount && !atomic_load(&job->failed); b += count) {
+        size_t first = (size_t)b * PAYLOAD_FEC_COLUMNS;
+        size_t width = stride - first < PAYLOAD_FEC_COLUMNS ? stride - first : PAYLOAD_FEC_COLUMNS;
+        const unsigned char *parity = job->data + job->rows * stride + first;
+
+        kernels.rsEncode(job->tables, nsym, job->data + first, stride, job->rows, remainders, width, width);
+        memset(dirty, 0, width);
+        for (int m = 0; m < nsym; m++) {
+            unsigned char *remainder = remainders + (size_t)m * width;
+            for (size_t i = 0; i < width; i++) {
+                remainder[i] ^= parity[(size_t)m * stride + i];
+                dirty[i] |= remainder[i];
+            }
+        }
+
+        for (size_t i = 0; i < width; i++) {
+            if (!dirty[i]) continue;
+
+            unsigned char codeword[255], remainder[RS_MAX_PARITY], syndromes[RS_MAX_PARITY];
+            unsigned char *column = job->data + first + i;
+            for (int j = 0; j < n; j++) codeword[j] = column[(size_t)j * stride];
+            for (int m = 0; m < nsym; m++) remainder[m] = remainders[(size_t)m * width + i];
+            rsSyndromes(remainder, nsym, syndromes);
+
+            int fixed = rsCorrect(codeword, n, nsym, syndromes);
+            if (fixed < 0) {
+                atomic_store(&job->failed, 1);
+                break;
+            }
+            for (int j = 0; j < n; j++) column[(size_t)j * stride] = codeword[j];
+            atomic_fetch_add(&job->corrected, (size_t)fixed);
+        }
+    }
+    free(remainders);
+}
+
+// Tables for the generator coefficients of job->nsym parity bytes
+static void fecTables(struct fecJob *job) {
+    unsigned char generator[RS_MAX_PARITY + 1];
+    gfInit();
+    rsGenerator(job->nsym, generator);
+    for (int m = 0; m < job->nsym; m++) gfTable(generator[m + 1], job->tables[m]);
+}
+
+// Adds the error correction header and parity behind the `length`
+// bytes at body + PAYLOAD_FEC_HEADER (the padding has to be zero)
+static void payloadFecEncode(unsigned char *body, size_t length) {
+    struct fecJob job = { .nsym = payloadParity };
+
+    for (int c = 0; c < 3; c++) {
+        body[c * PAYLOAD_FEC_FIELDS] = (unsigned char)payloadParity;
+        streamPutU64(body + c * PAYLOAD_FEC_FIELDS + 1, length);
+    }
+
+    fecLayout(length, job.nsym, &job.codewords, &job.rows);
+    job.data = body + PAYLOAD_FEC_HEADER;
+    job.blockCount = (int)((job.codewords - 1) / PAYLOAD_FEC_COLUMNS + 1);
+    fecTables(&job);
+
+    parallelRun(threadsFor(job.blockCount, 1), fecEncodePart, &job);
+}
+
+// ------------------------------------------------------------
+// Function: payloadFecDecode
+// Purpose : Repairs an extracted message with PAYLOAD_FLAG_RS and
+//           strips the error correction (*message keeps its buffer)
+// Returns : 0 on success, -1 if the damage is beyond repair
+//           (*message freed, NULL)
+// ------------------------------------------------------------
+static int payloadFecDecode(unsigned char **message, size_t *msgLen) {
+    struct fecJob job = { 0 };
+    unsigned char fields[PAYLOAD_FEC_FIELDS];
+    uint64_t length = 0;
+
+    if (*msgLen > PAYLOAD_FEC_HEADER) {
+        const unsigned char *copies = *message;
+        for (int i = 0; i < PAYLOAD_FEC_FIELDS; i++) {
+            unsigned char a = copies[i], b = copies[PAYLOAD_FEC_FIELDS + i], c = copies[2 * PAYLOAD_FEC_FIELDS + i];
+            fields[i] = (a & b) | (a & c) | (b & c);
+        }
+        job.nsym = fields[0];
+        length = streamGetU64(fields + 1);
+    }
+
+    if (job.nsym < 2 || job.nsym > RS_MAX_PARITY || job.nsym % 2 != 0 || length == 0 || length > *msgLen ||
+        fecStoredLength((size_t)length, job.nsym) != *msgLen) {
+        printf("Invalid error correction data.\n");
+    } else {
+        fecLayout((size_t)length, job.nsym, &job.codewords, &job.rows);
+        job.data = *message + PAYLOAD_FEC_HEADER;
+        job.blockCount = (int)((job.codewords - 1) / PAYLOAD_FEC_COLUMNS + 1);
+        fecTables(&job);
+
+        parallelRun(threadsFor(job.blockCount, 1), fecDecodePart, &job);
+
+        if (atomic_load(&job.failed)) {
+            printf("Too many damaged bytes, the error correction failed.\n");
+        } else {
+            if (atomic_load(&job.corrected) > 0) {
+                printf("Error correction repaired %zu damaged bytes.\n", (size_t)atomic_load(&job.corrected));
+            }
+            memmove(*message, job.data, (size_t)length);
+            (*message)[length] = '\0';
+            *msgLen = (size_t)length;
+            return 0;
+        }
+    }
+
+    free(*message);
+    *message = NULL;
+    return -1;
+}
+
+// ------------------------------------------------------------
+// Payload encryption (embed / extract --key)
+// An encrypted message (PAYLOAD_FLAG_AES_GCM) is stored as a random
+// 96 bit nonce, the AES-256-GCM ciphertext and the 128 bit tag. The
+// version 2 header the message would have without --fec is the
+// additional authenticated data, so flags and length can't be changed
+// unnoticed either.
+//
+// The cipher runs over PAYLOAD_CRYPT_CHUNK pieces on the worker
+// threads. payloadStream encrypts where it used to copy, and
+// embedPayload encrypts one window at a time right before embedding
+// it, so the ciphertext is still in cache and encryption costs no
+// extra pass over the message.
+// ------------------------------------------------------------
+#define PAYLOAD_CRYPT_OVERHEAD (GCM_NONCE_BYTES + GCM_TAG_BYTES)
+#define PAYLOAD_CRYPT_CHUNK (64 << 10)
+#define PAYLOAD_CRYPT_WINDOW (1 << 20) // multiple of the chunk size
+
+static struct gcmKey payloadKey;
+static int payloadEncrypted = 0; // 1 once --key has been given
+
+struct gcmStream {
+    const struct gcmKey *key;
+    unsigned char counter[16];    // J0 = nonce, counter 1
+    unsigned char hash[16];
+    unsigned char chunkPower[16]; // h^(blocks per chunk)
+    uint64_t length, aadLength;
+};
+
+struct gcmJob {
+    struct gcmStream *s;
+    const unsigned char *in;
+    unsigned char *out;
+    size_t length;
+    int decrypt;
+    int chunkCount;
+    unsigned char (*hashes)[16];
+};
+
+static void gcmStart(struct gcmStream *s, const struct gcmKey *key, const unsigned char nonce[GCM_NONCE_BYTES],
+                     const unsigned char *aad, size_t aadLength) {
+    memset(s, 0, sizeof(*s));
+    s->key = key;
+    memcpy(s->counter, nonce, GCM_NONCE_BYTES);
+    s->counter[15] = 1;
+    s->aadLength = aadLength;
+    for (size_t pos = 0; pos < aadLength; pos += 16) {
+        for (size_t i = 0; i < 16 && pos + i < aadLength; i++) s->hash[i] ^= aad[pos + i];
+        gcmMultiply(s->hash, key->h);
+    }
+    gcmPower(key, PAYLOAD_CRYPT_CHUNK / 16, s->chunkPower);
+}
+
+static void gcmChunkPart(void *ctx, int index, int count) {
+    struct gcmJob *job = ctx;
+    for (int c = index; c < job->chunkCount; c += count) {
+        size_t offset = (size_t)c * PAYLOAD_CRYPT_CHUNK;
+        size_t n = job->length - offset < PAYLOAD_CRYPT_CHUNK ? job->length - offset : PAYLOAD_CRYPT_CHUNK;
+        unsigned char counter[16];
+        gcmCounterAdd(counter, job->s->counter, (uint32_t)(1 + (job->s->length + offset) / 16));
+        kernels.gcmBlocks(job->s->key, counter, job->in + offset, job->out + offset, n, job->decrypt, job->hashes[c]);
+    }
+}
+
+// ------------------------------------------------------------
+// Function: gcmUpdate
+// Purpose : En- or decrypts the next `length` bytes (a multiple of
+//           16 except for the last call) and adds them to the hash
+// Method  : Every chunk is hashed on its own by whichever thread
+//           gets it; the hashes are chained in order afterwards
+// Returns : 0 on success, -1 if out of memory
+// ------------------------------------------------------------
+static int gcmUpdate(struct gcmStream *s, const unsigned char *in, unsigned char *out, size_t length, int decrypt) {
+    struct gcmJob job = { s, in, out, length, decrypt, (int)((length + PAYLOAD_CRYPT_CHUNK - 1) / PAYLOAD_CRYPT_CHUNK), NULL };
+    if (length == 0) return 0;
+    job.hashes = calloc(job.chunkCount, 16);
+    if (!job.hashes) return -1;
+
+    parallelRun(threadsFor(length, PAYLOAD_CRYPT_CHUNK), gcmChunkPart, &job);
+
+    for (int c = 0; c < job.chunkCount; c++) {
+        size_t n = length - (size_t)c * PAYLOAD_CRYPT_CHUNK;
+        if (n >= PAYLOAD_CRYPT_CHUNK) {
+            gcmCombine(s->hash, s->chunkPower, job.hashes[c]);
+        } else {
+            unsigned char power[16];
+            gcmPower(s->key, (n + 15) / 16, power);
+            gcmCombine(s->hash, power, job.hashes[c]);
+        }
+    }
+    s->length += length;
+    free(job.hashes);
+    return 0;
+}
+
+static void gcmFinish(struct gcmStream *s, unsigned char tag[GCM_TAG_BYTES]) {
+    unsigned char lengths[16], mask[16];
+    gcmPutU64(lengths, s->aadLength * 8);
+    gcmPutU64(lengths + 8, s->length * 8);
+    for (int i = 0; i < 16; i++) s->hash[i] ^= lengths[i];
+    gcmMultiply(s->hash, s->key->h);
+
+    gcmEncryptBlock(s->key, s->counter, mask);
+    for (int i = 0; i < GCM_TAG_BYTES; i++) tag[i] = s->hash[i] ^ mask[i];
+}
+
+// ------------------------------------------------------------
+// Function: payloadKeySet
+// Purpose : Applies a --key value: 64 hex digits, or a file holding
+//           32 raw bytes or 64 hex digits
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int payloadKeySet(const char *value) {
+    unsigned char secret[GCM_KEY_BYTES], text[2 * GCM_KEY_BYTES + 2];
+    size_t length = strlen(value);
+    const char *hex = value;
+
+    FILE *f = fopen(value, "rb");
+    int raw = 0;
+    if (f) {
+        length = fread(text, 1, sizeof(text), f);
+        fclose(f);
+        raw = length == GCM_KEY_BYTES;
+        while (!raw && length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r' || text[length - 1] == ' ')) length--;
+        hex = (const char *)text;
+    }
+
+    int valid = 1;
+    if (raw) {
+        memcpy(secret, text, GCM_KEY_BYTES);
+    } else if (length == 2 * GCM_KEY_BYTES) {
+        for (int i = 0; i < 2 * GCM_KEY_BYTES && valid; i++) {
+            char c = hex[i];
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) valid = 0;
+            else if (i % 2 == 0) secret[i / 2] = (unsigned char)(digit << 4);
+            else secret[i / 2] |= (unsigned char)digit;
+        }
+    } else {
+        valid = 0;
+    }
+
+    if (valid) {
+        gcmKeyInit(&payloadKey, secret, kernels.gcmBlocks != gcmBlocksPortable);
+        payloadEncrypted = 1;
+    } else {
+        printf("Invalid key (use 64 hex digits, or a file holding 32 bytes or 64 hex digits).\n");
+    }
+    memset(secret, 0, sizeof(secret));
+    memset(text, 0, sizeof(text));
+    return valid ? 0 : -1;
+}
+
+// Bytes a message of msgLen bytes takes up behind the header
+size_t payloadStoredLength(size_t msgLen) {
+    size_t stored = (payloadEncrypted ? msgLen + PAYLOAD_CRYPT_OVERHEAD : msgLen) + PAYLOAD_CRC_BYTES;
+    return payloadParity ? fecStoredLength(stored, payloadParity) : stored;
+}
+
+// Writes the header into stream and the nonce to `nonce`, then starts the cipher
+static int payloadSealStart(unsigned char *stream, unsigned char *nonce, size_t msgLen, int flags, struct gcmStream *s) {
+    unsigned char authenticated[PAYLOAD_V2_BYTES];
+    flags |= PAYLOAD_FLAG_AES_GCM;
+    payloadPutHeader(stream, payloadStoredLength(msgLen), flags);
+    payloadPutHeaderV2(authenticated, msgLen + PAYLOAD_CRYPT_OVERHEAD, flags & ~PAYLOAD_FLAG_RS);
+    if (gcmRandom(nonce, GCM_NONCE_BYTES) != 0) {
+        printf("Could not get random bytes for the nonce.\n");
+        return -1;
+    }
+    gcmStart(s, &payloadKey, nonce, authenticated, PAYLOAD_V2_BYTES);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: payloadOpen
+// Purpose : Decrypts an extracted message and checks its tag;
+//           *message is replaced (the old one freed)
+// Returns : 0 on success, -1 without key / on a wrong key or
+//           modified content (*message freed, NULL)
+// ------------------------------------------------------------
+static int payloadOpen(int flags, unsigned char **message, size_t *msgLen) {
+    unsigned char *sealed = *message, *plain = NULL;
+    *message = NULL;
+
+    if (!payloadEncrypted) {
+        printf("The content is encrypted, extract it with --key.\n");
+    } else if (*msgLen < PAYLOAD_CRYPT_OVERHEAD) {
+        printf("The encrypted content is too short, it is damaged.\n");
+    } else if (!(plain = streamAlloc(*msgLen - PAYLOAD_CRYPT_OVERHEAD + 1))) {
+        printf("Out of memory while decrypting.\n");
+    } else {
+        size_t plainLen = *msgLen - PAYLOAD_CRYPT_OVERHEAD;
+        unsigned char header[PAYLOAD_V2_BYTES], tag[GCM_TAG_BYTES], difference = 0;
+        struct gcmStream s;
+
+        payloadPutHeaderV2(header, *msgLen, flags & PAYLOAD_FLAGS_KNOWN & ~PAYLOAD_FLAG_RS);
+        gcmStart(&s, &payloadKey, sealed, header, PAYLOAD_V2_BYTES);
+        if (gcmUpdate(&s, sealed + GCM_NONCE_BYTES, plain, plainLen, 1) == 0) {
+            gcmFinish(&s, tag);
+            for (int i = 0; i < GCM_TAG_BYTES; i++) difference |= tag[i] ^ sealed[GCM_NONCE_BYTES + plainLen + i];
+            if (difference == 0) {
+                *message = plain;
+                *msgLen = plainLen;
+            } else {
+                printf("Wrong key or modified content (authentication failed).\n");
+            }
+        } else {
+            printf("Out of memory while decrypting.\n");
+        }
+    }
+
+    free(sealed);
+    if (*message == NULL) {
+        free(plain);
+        return -1;
+    }
+    return 0;
+}
+
+// Flags written into the headers (set by payloadCompress)
+static int payloadFlags = 0;
+
+// Header + message as one stream of PAYLOAD_HEADER_BITS + 8 *
+// payloadStoredLength(msgLen) bits (free() it), NULL on error
+unsigned char *payloadStream(const unsigned char *message, size_t msgLen) {
+    size_t stored = payloadStoredLength(msgLen), protected = msgLen;
+    int flags = payloadParity ? payloadFlags | PAYLOAD_FLAG_RS : payloadFlags;
+    unsigned char *stream = streamAlloc(PAYLOAD_HEADER_BYTES + stored);
+    if (!stream) return NULL;
+    unsigned char *body = stream + PAYLOAD_HEADER_BYTES + (payloadParity ? PAYLOAD_FEC_HEADER : 0);
+
+    if (!payloadEncrypted) {
+        payloadPutHeader(stream, stored, flags);
+        memcpy(body, message, msgLen);
+    } else {
+        struct gcmStream s;
+        unsigned char *cipher = body + GCM_NONCE_BYTES;
+        if (payloadSealStart(stream, body, msgLen, flags, &s) != 0 || gcmUpdate(&s, message, cipher, msgLen, 0) != 0) {
+            free(stream);
+            return NULL;
+        }
+        gcmFinish(&s, cipher + msgLen);
+        protected += PAYLOAD_CRYPT_OVERHEAD;
+    }
+
+    streamPutU32(body + protected, payloadCrc(streamGetU32(stream + 12), body, protected));
+    protected += PAYLOAD_CRC_BYTES;
+    if (payloadParity) payloadFecEncode(stream + PAYLOAD_HEADER_BYTES, protected);
+    return stream;
+}
+
+// ------------------------------------------------------------
+// Payload compression (embed --compress)
+// A compressed message (PAYLOAD_FLAG_DEFLATE) is stored as its
+// original length (64 bit) followed by a zlib stream; the header
+// length counts the stored bytes, so every carrier handles it like
+// any other message. Fewer bytes means fewer pixels, rows and
+// segments touched on both embedding and extraction.
+//
+// Content that is compressed already (archives, JPEGs, ...) has
+// close to 8 bits of entropy per byte and won't shrink, so a few
+// samples are checked first and such content is stored as it is.
+// The deflate runs in 1 MB blocks on the worker threads, each block
+// with the 32 KB in front of it as history.
+// ------------------------------------------------------------
+#define PAYLOAD_DEFLATE_LEVEL 6
+#define PAYLOAD_DEFLATE_BLOCK (1 << 20)
+#define PAYLOAD_PROBE_BLOCK 4096     // bytes per entropy sample
+#define PAYLOAD_PROBE_SAMPLES 16
+#define PAYLOAD_PROBE_LIMIT 7.5      // bits per byte above which compression is skipped
+#define PAYLOAD_INFLATE_RATIO 1032   // deflate can't expand more than this
+
+// Order-0 entropy in bits per byte, estimated from evenly spread samples
+static double payloadEntropy(const unsigned char *message, size_t msgLen) {
+    size_t counts[256] = { 0 };
+    size_t sampled = 0;
+
+    if (msgLen <= PAYLOAD_PROBE_BLOCK * PAYLOAD_PROBE_SAMPLES) {
+        // short messages are counted as a whole
+        for (size_t i = 0; i < msgLen; i++) counts[message[i]]++;
+        sampled = msgLen;
+    } else {
+        for (int s = 0; s < PAYLOAD_PROBE_SAMPLES; s++) {
+            const unsigned char *sample = message + msgLen / PAYLOAD_PROBE_SAMPLES * s;
+            for (size_t i = 0; i < PAYLOAD_PROBE_BLOCK; i++) counts[sample[i]]++;
+        }
+        sampled = PAYLOAD_PROBE_BLOCK * PAYLOAD_PROBE_SAMPLES;
+    }
+
+    double bits = 0;
+    for (int c = 0; c < 256; c++) {
+        if (counts[c] == 0) continue;
+        double p = (double)counts[c] / sampled;
+        bits -= p * log2(p);
+    }
+    return bits;
+}
+
+struct payloadDeflateJob {
+    const unsigned char *message;
+    size_t msgLen;
+    int blockCount;
+    struct zwriter *blocks;
+    atomic_int failed;
+};
+
+static void payloadDeflatePart(void *ctx, int index, int count) {
+    struct payloadDeflateJob *job = ctx;
+
+    for (int b = index; b < job->blockCount && !atomic_load(&job->failed); b += count) {
+        size_t start = (size_t)b * PAYLOAD_DEFLATE_BLOCK;
+        size_t end = job->msgLen - start > PAYLOAD_DEFLATE_BLOCK ? start + PAYLOAD_DEFLATE_BLOCK : job->msgLen;
+        if (deflateRange(job->message, start, end, job->msgLen, PAYLOAD_DEFLATE_LEVEL, b == job->blockCount - 1,
+                         &job->blocks[b]) != 0) {
+            atomic_store(&job->failed, 1);
+        }
+    }
+}
+
+// ------------------------------------------------------------
+// Function: payloadCompress
+// Purpose : Compresses the message for embedding, unless the entropy
+//           probe says it won't pay off or it doesn't get smaller
+// Method  : On success the following headers get PAYLOAD_FLAG_DEFLATE
+//           and *msgLen is the compressed size
+// Returns : malloc'ed compressed message, NULL if the message is to
+//           be stored as it is (the reason has been printed)
+// ------------------------------------------------------------
+unsigned char *payloadCompress(const unsigned char *message, size_t *msgLen) {
+    if (*msgLen == 0) return NULL;
+
+    double entropy = payloadEntropy(message, *msgLen);
+    if (entropy > PAYLOAD_PROBE_LIMIT) {
+        printf("Content looks compressed already (%.2f bits per byte), embedding it as it is.\n", entropy);
+        return NULL;
+    }
+
+    struct payloadDeflateJob job = { message, *msgLen, (int)((*msgLen - 1) / PAYLOAD_DEFLATE_BLOCK + 1), NULL, 0 };
+    job.blocks = calloc(job.blockCount, sizeof(*job.blocks));
+    if (job.blocks) {
+        deflateHeader(&job.blocks[0]);
+        parallelRun(threadsFor(job.blockCount, 1), payloadDeflatePart, &job);
+    }
+
+    // original length, zlib header + blocks, Adler-32 (big endian)
+    size_t packedLen = 8 + 4;
+    for (int b = 0; job.blocks && b < job.blockCount; b++) packedLen += job.blocks[b].size;
+    unsigned char *packed = NULL;
+    if (job.blocks && !atomic_load(&job.failed) && packedLen < *msgLen && (packed = malloc(packedLen))) {
+        size_t at = 8;
+        streamPutU64(packed, *msgLen);
+        for (int b = 0; b < job.blockCount; b++) {
+            memcpy(packed + at, job.blocks[b].data, job.blocks[b].size);
+            at += job.blocks[b].size;
+        }
+        uint32_t adler = adler32(1, message, *msgLen);
+        for (int i = 0; i < 4; i++) packed[at + i] = (unsigned char)(adler >> (24 - 8 * i));
+
+        printf("Compressed content: %zu -> %zu bytes.\n", *msgLen, packedLen);
+        *msgLen = packedLen;
+        payloadFlags |= PAYLOAD_FLAG_DEFLATE;
+    } else if (job.blocks && !atomic_load(&job.failed)) {
+        printf("Content doesn't get smaller when compressed, embedding it as it is.\n");
+    } else {
+        printf("Out of memory while compressing, embedding the content as it is.\n");
+    }
+
+    for (int b = 0; job.blocks && b < job.blockCount; b++) zwFree(&job.blocks[b]);
+    free(job.blocks);
+    return packed;
+}
+
+struct payloadSource {
+    const unsigned char *data;
+    size_t length;
+};
+
+static size_t payloadRefill(void *ctx, const unsigned char **data) {
+    struct payloadSource *source = ctx;
+    size_t length = source->length;
+    *data = source->data;
+    source->length = 0;
+    return length;
+}
+
+// ------------------------------------------------------------
+// Function: payloadUnpack
+// Purpose : Undoes error correction, checks the CRC32C trailer and
+//           undoes encryption and compression after extraction as far
+//           as the header flags say so; *message holds the stored
+//           bytes and is replaced (the old one freed)
+// Returns : 0 on success (or nothing to do), -1 if the content is
+//           damaged, can't be decrypted or is implausible
+//           (*message freed, NULL)
+// ------------------------------------------------------------
+int payloadUnpack(int flags, unsigned char **message, size_t *msgLen) {
+    uint64_t stored = *msgLen;
+    if ((flags & PAYLOAD_FLAG_RS) && payloadFecDecode(message, msgLen) != 0) return -1;
+    if ((flags & PAYLOAD_CHECKED) && payloadVerify(flags, stored, message, msgLen) != 0) return -1;
+    if ((flags & PAYLOAD_FLAG_AES_GCM) && payloadOpen(flags, message, msgLen) != 0) return -1;
+    if (!(flags & PAYLOAD_FLAG_DEFLATE)) return 0;
+
+    unsigned char *packed = *message, *plain = NULL;
+    uint64_t plainLen = *msgLen >= 8 ? streamGetU64(packed) : 0;
+    *message = NULL;
+
+    if (*msgLen >= 8 + 6 && plainLen > 0 && plainLen / PAYLOAD_INFLATE_RATIO <= *msgLen &&
+        plainLen < SIZE_MAX - LSB_STREAM_PADDING - 1 && (plain = streamAlloc((size_t)plainLen + 1))) {
+        struct payloadSource source = { packed + 8, *msgLen - 8 };
+        struct inflater *z = malloc(sizeof(*z));
+        unsigned char extra;
+
+        // all bytes, then the end of the stream with a matching Adler-32
+        if (z) inflateInit(z, payloadRefill, &source, 0);
+        if (z && inflateRead(z, plain, (size_t)plainLen) == plainLen && inflateRead(z, &extra, 1) == 0 &&
+            z->state == ZS_DONE) {
+            *message = plain;
+            *msgLen = (size_t)plainLen;
+        }
+        free(z);
+    }
+
+    free(packed);
+    if (*message == NULL) {
+        free(plain);
+        printf("Invalid or corrupted compressed content.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: embedPayload
+// Purpose : Embeds the header and the message
+// Method  : With a key (and no --fec, whose parity needs all of it),
+//           the message is encrypted and embedded one window at a time
+// Returns : 0 on success, -1 if the message doesn't fit / no memory
+// ------------------------------------------------------------
+int embedPayload(const struct pixelGeometry *g, const unsigned char *message, size_t msgLen) {
+    size_t stored = payloadStoredLength(msgLen);
+    if (stored > payloadCapacity(g)) return -1;
+
+    if (!payloadEncrypted || payloadParity) {
+        unsigned char *stream = payloadStream(message, msgLen);
+        if (!stream) return -1;
+
+        geometryEmbedBits(g, 0, stream, 0, PAYLOAD_HEADER_BITS + stored * 8);
+        free(stream);
+        return 0;
+    }
+
+    unsigned char *stream = streamAlloc(PAYLOAD_HEADER_BYTES + stored);
+    struct gcmStream s;
+    size_t at = PAYLOAD_HEADER_BYTES + GCM_NONCE_BYTES; // bytes embedded so far
+    if (!stream || payloadSealStart(stream, stream + PAYLOAD_HEADER_BYTES, msgLen, payloadFlags, &s) != 0) {
+        free(stream);
+        return -1;
+    }
+    geometryEmbedBits(g, 0, stream, 0, at * 8);
+    uint32_t crc = payloadCrc(streamGetU32(stream + 12), stream + PAYLOAD_HEADER_BYTES, GCM_NONCE_BYTES);
+
+    int result = 0;
+    for (size_t pos = 0; pos < msgLen && result == 0; pos += PAYLOAD_CRYPT_WINDOW) {
+        size_t n = msgLen - pos < PAYLOAD_CRYPT_WINDOW ? msgLen - pos : PAYLOAD_CRYPT_WINDOW;
+        result = gcmUpdate(&s, message + pos, stream + at, n, 0);
+        if (result == 0) {
+            geometryEmbedBits(g, at * 8, stream, at * 8, n * 8);
+            crc = payloadCrc(crc, stream + at, n);
+        }
+        at += n;
+    }
+    if (result == 0) {
+        gcmFinish(&s, stream + at);
+        streamPutU32(stream + at + GCM_TAG_BYTES, payloadCrc(crc, stream + at, GCM_TAG_BYTES));
+        geometryEmbedBits(g, at * 8, stream, at * 8, (GCM_TAG_BYTES + PAYLOAD_CRC_BYTES) * 8);
+    }
+
+    free(stream);
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: extractPayload
+// Purpose : Reads the header and the message behind it into
+//           *message (malloc'ed, with a NUL behind it for convenience)
+// Returns : 1 = found, 0 = no plausible header, -1 = the content
+//           behind the header was rejected (the reason has been
+//           printed by payloadUnpack)
+// ------------------------------------------------------------
+int extractPayload(const struct pixelGeometry *g, unsigned char **message, size_t *msgLen) {
+    unsigned char header[PAYLOAD_HEADER_BYTES + LSB_STREAM_PADDING];
+    struct payloadHeader h;
+    *message = NULL;
+    *msgLen = 0;
+
+    if (geometryExtractBits(g, 0, header, 0, PAYLOAD_LEGACY_BITS) != 0) return 0;
+    size_t headerBits = payloadHeaderBits(header);
+    if (headerBits > PAYLOAD_LEGACY_BITS &&
+        geometryExtractBits(g, PAYLOAD_LEGACY_BITS, header, PAYLOAD_LEGACY_BITS, headerBits - PAYLOAD_LEGACY_BITS) != 0) {
+        return 0;
+    }
+    if (payloadParseHeader(header, g->totalSlots, &h) != 0) return 0;
+
+    *message = streamAlloc((size_t)h.length + 1);
+    if (!*message) return 0;
+
+    geometryExtractBits(g, h.headerBits, *message, 0, (size_t)h.length * 8);
+    *msgLen = (size_t)h.length;
+
+    return payloadUnpack(h.flags, message, msgLen) == 0 ? 1 : -1;
+}
+
+// ------------------------------------------------------------
+// Payload benchmarks (stego bench)
+// ------------------------------------------------------------
+#define BENCH_PARITY_PERCENT 10
+
+// Best time of `runs` encryptions of the message (into scratch) with the bound kernel
+static double benchCipher(const struct gcmKey *key, const unsigned char *message, size_t msgLen,
+                          unsigned char *scratch, int runs) {
+    unsigned char nonce[GCM_NONCE_BYTES] = { 0 }, tag[GCM_TAG_BYTES];
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        struct gcmStream s;
+        double start = timeNow();
+        gcmStart(&s, key, nonce, NULL, 0);
+        gcmUpdate(&s, message, scratch, msgLen, 0);
+        gcmFinish(&s, tag);
+        double elapsed = timeNow() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Best time for the Reed-Solomon parity of msgLen bytes already in
+// buffer (laid out by payloadFecEncode)
+static double benchParity(unsigned char *buffer, size_t msgLen, int runs) {
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = timeNow();
+        payloadFecEncode(buffer, msgLen);
+        double elapsed = timeNow() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Best time for the CRC32C trailer over msgLen bytes
+static double benchChecksum(const unsigned char *message, size_t msgLen, int runs) {
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = timeNow();
+        payloadCrc(0, message, msgLen);
+        double elapsed = timeNow() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// One table row: time, throughput and the share of an embedding
+static void benchRow(const char *name, double elapsed, size_t msgLen, double embedTime) {
+    printf("%-20s %8.3f s %9.0f MB/s", name, elapsed, elapsed > 0 ? msgLen / elapsed / 1e6 : 0.0);
+    if (embedTime > 0) printf(" (%.2f%% of embedding)", 100.0 * elapsed / embedTime);
+    printf("\n");
+}
+
+// ------------------------------------------------------------
+// Function: benchPayload
+// Purpose : Measures what the payload stages cost on the message:
+//           AES-256-GCM (--key), Reed-Solomon parity (--fec 10) and
+//           the CRC32C trailer, each with the bound kernel and the
+//           portable one, relative to embedTime (0 = unknown)
+// Method  : `runs` runs each, the fastest counts. Encryption uses a
+//           random key; the engine's settings are left alone.
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int benchPayload(const unsigned char *message, size_t msgLen, int runs, double embedTime) {
+    int nsym = payloadParityFor(BENCH_PARITY_PERCENT), parity = payloadParity;
+    unsigned char *scratch = calloc(msgLen + GCM_TAG_BYTES, 1);
+    unsigned char *protected = calloc(fecStoredLength(msgLen, nsym), 1);
+    unsigned char secret[GCM_KEY_BYTES];
+    struct gcmKey key;
+
+    if (!scratch || !protected || gcmRandom(secret, sizeof(secret)) != 0) {
+        printf("Could not prepare the payload benchmarks.\n");
+        free(scratch);
+        free(protected);
+        return -1;
+    }
+    memset(scratch, 1, msgLen + GCM_TAG_BYTES); // fault the pages in before timing
+
+    gcmBlocksFn boundCipher = kernels.gcmBlocks;
+    gcmKeyInit(&key, secret, boundCipher != gcmBlocksPortable);
+    memset(secret, 0, sizeof(secret));
+    printf("\n%-20s %10s %14s\n", "AES-256-GCM", "Time", "Throughput");
+    for (int pass = 0; pass < 2; pass++) {
+        kernels.gcmBlocks = pass == 0 ? boundCipher : gcmBlocksPortable;
+        benchRow(pass == 0 && boundCipher != gcmBlocksPortable ? "cipher (aes-ni)" : "cipher (portable)",
+                 benchCipher(&key, message, msgLen, scratch, runs), msgLen, embedTime);
+        if (boundCipher == gcmBlocksPortable) break;
+    }
+    kernels.gcmBlocks = boundCipher;
+    memset(&key, 0, sizeof(key));
+
+    rsEncodeFn boundParity = kernels.rsEncode;
+    payloadParity = nsym; // payloadFecEncode works with the --fec setting
+    memcpy(protected + PAYLOAD_FEC_HEADER, message, msgLen);
+    char title[32];
+    snprintf(title, sizeof(title), "Reed-Solomon %d%%", BENCH_PARITY_PERCENT);
+    printf("\n%-20s %10s %14s\n", title, "Time", "Throughput");
+    for (int pass = 0; pass < 2; pass++) {
+        kernels.rsEncode = pass == 0 ? boundParity : rsEncodeScalar;
+        benchRow(pass == 0 && boundParity != rsEncodeScalar ? "parity (pshufb)" : "parity (scalar)",
+                 benchParity(protected, msgLen, runs), msgLen, embedTime);
+        if (boundParity == rsEncodeScalar) break;
+    }
+    kernels.rsEncode = boundParity;
+    payloadParity = parity;
+
+    crc32cFn boundChecksum = kernels.crc32c;
+    printf("\n%-20s %10s %14s\n", "CRC32C", "Time", "Throughput");
+    for (int pass = 0; pass < 2; pass++) {
+        kernels.crc32c = pass == 0 ? boundChecksum : crc32cPortable;
+        benchRow(pass == 0 && boundChecksum != crc32cPortable ? "checksum (sse4.2)" : "checksum (portable)",
+                 benchChecksum(message, msgLen, runs), msgLen, embedTime);
+        if (boundChecksum == crc32cPortable) break;
+    }
+    kernels.crc32c = boundChecksum;
+
+    free(scratch);
+    free(protected);
+    return 0;
+}
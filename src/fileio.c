@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FILEIO_MMAP 1
+#endif
+
+// ------------------------------------------------------------
+// File buffers
+// Whole-file access for the image backends. Regular files are
+// memory-mapped, everything else (pipes, devices, Windows builds)
+// goes through a heap buffer and stdio.
+// ------------------------------------------------------------
+struct fileBuffer {
+    unsigned char *data;
+    size_t size;
+    int mapped;   // 1 = data is an mmap'ed view of the file
+    FILE *output; // heap-buffered output, written out by fileClose()
+};
+
+// Reads a whole stream into a heap buffer (fallback path)
+static int fileReadStream(FILE *in, struct fileBuffer *f) {
+    size_t capacity = 1 << 16;
+    f->data = malloc(capacity);
+    f->size = 0;
+    if (!f->data) return -1;
+
+    size_t n;
+    while ((n = fread(f->data + f->size, 1, capacity - f->size, in)) > 0) {
+        f->size += n;
+        if (f->size == capacity) {
+            unsigned char *bigger = realloc(f->data, capacity * 2);
+            if (!bigger) {
+                free(f->data);
+                f->data = NULL;
+                return -1;
+            }
+            f->data = bigger;
+            capacity *= 2;
+        }
+    }
+    return ferror(in) ? -1 : 0;
+}
+
+// ------------------------------------------------------------
+// Function: fileReadCopy
+// Purpose : Loads a whole file into a private heap buffer
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int fileReadCopy(const char *path, struct fileBuffer *f) {
+    memset(f, 0, sizeof(*f));
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return -1;
+
+    int result = fileReadStream(in, f);
+    fclose(in);
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: fileMapRead
+// Purpose : Maps a file read-only for one sequential pass
+//           (falls back to fileReadCopy for non-regular files)
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int fileMapRead(const char *path, struct fileBuffer *f) {
+#ifdef FILEIO_MMAP
+    memset(f, 0, sizeof(*f));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return -1;
+
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        f->data = data;
+        f->size = (size_t)st.st_size;
+        f->mapped = 1;
+        return 0;
+    }
+    close(fd);
+#endif
+    return fileReadCopy(path, f);
+}
+
+// ------------------------------------------------------------
+// Function: fileMapWrite
+// Purpose : Creates (or truncates) a file of the given size and maps
+//           it writable, so it can be filled in place. Non-regular
+//           targets get a heap buffer that fileClose() writes out.
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int fileMapWrite(const char *path, size_t size, struct fileBuffer *f) {
+    memset(f, 0, sizeof(*f));
+
+#ifdef FILEIO_MMAP
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (size > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return -1;
+
+        f->data = data;
+        f->size = size;
+        f->mapped = 1;
+        return 0;
+    }
+    close(fd);
+#endif
+
+    f->output = fopen(path, "wb");
+    if (!f->output) return -1;
+
+    f->data = malloc(size ? size : 1);
+    if (!f->data) {
+        fclose(f->output);
+        f->output = NULL;
+        return -1;
+    }
+    f->size = size;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: fileClose
+// Purpose : Unmaps / frees a file buffer; heap-buffered outputs
+//           are written to their file first
+// Returns : 0 on success, -1 if writing the output failed
+// ------------------------------------------------------------
+int fileClose(struct fileBuffer *f) {
+    int result = 0;
+
+    if (f->data == NULL) return 0;
+
+#ifdef FILEIO_MMAP
+    if (f->mapped) {
+        munmap(f->data, f->size);
+        f->data = NULL;
+        return 0;
+    }
+#endif
+
+    if (f->output) {
+        if (fwrite(f->data, 1, f->size, f->output) != f->size) result = -1;
+        if (fclose(f->output) != 0) result = -1;
+        f->output = NULL;
+    }
+
+    free(f->data);
+    f->data = NULL;
+    return result;
+}
+
+// Returns 1 if both paths name the same existing file
+int fileIsSame(const char *a, const char *b) {
+#ifdef FILEIO_MMAP
+    struct stat sa, sb;
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0) return 0;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#else
+    return strcmp(a, b) == 0;
+#endif
+}
+
+// ------------------------------------------------------------
+// Positioned I/O
+// Small reads / writes at absolute offsets, used by the modes that
+// only touch parts of a file. pread / pwrite where available,
+// seek + stdio otherwise. Both return 0 once all bytes are done.
+// ------------------------------------------------------------
+int fileReadAt(FILE *f, long long offset, void *buffer, size_t length) {
+#ifdef FILEIO_MMAP
+    unsigned char *p = buffer;
+    while (length > 0) {
+        ssize_t n = pread(fileno(f), p, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n; offset += n; length -= (size_t)n;
+    }
+    return 0;
+#else
+    if (_fseeki64(f, offset, SEEK_SET) != 0) return -1;
+    return fread(buffer, 1, length, f) == length ? 0 : -1;
+#endif
+}
+
+int fileWriteAt(FILE *f, long long offset, const void *buffer, size_t length) {
+#ifdef FILEIO_MMAP
+    const unsigned char *p = buffer;
+    while (length > 0) {
+        ssize_t n = pwrite(fileno(f), p, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n; offset += n; length -= (size_t)n;
+    }
+    return 0;
+#else
+    if (_fseeki64(f, offset, SEEK_SET) != 0) return -1;
+    return fwrite(buffer, 1, length, f) == length ? 0 : -1;
+#endif
+}
+
+// Size of an open file in bytes, -1 if unknown
+long long fileSizeOf(FILE *f) {
+#ifdef FILEIO_MMAP
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+    return (long long)st.st_size;
+#else
+    if (_fseeki64(f, 0, SEEK_END) != 0) return -1;
+    return _ftelli64(f);
+#endif
+}
+
+// ------------------------------------------------------------
+// Function: fileCopy
+// Purpose : Copies a file, inside the kernel where possible
+//           (copy_file_range can even share the blocks on CoW
+//           file systems)
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int fileCopy(const char *source, const char *target) {
+    FILE *in = fopen(source, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(target, "wb");
+    if (!out) { fclose(in); return -1; }
+
+    int result = 0;
+
+#if defined(__linux__)
+    // Let the kernel copy; falls through to stdio if it isn't supported here
+    long long remaining = fileSizeOf(in);
+    long long copied = 0;
+    while (copied < remaining) {
+        ssize_t n = copy_file_range(fileno(in), NULL, fileno(out), NULL, (size_t)(remaining - copied), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += n;
+    }
+    if (remaining >= 0 && copied == remaining) {
+        fclose(in);
+        return fclose(out) == 0 ? 0 : -1;
+    }
+    if (copied > 0) result = -1; // failed half way through
+#endif
+
+    static unsigned char chunk[1 << 20];
+    size_t n;
+    while (result == 0 && (n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        if (fwrite(chunk, 1, n, out) != n) result = -1;
+    }
+    if (ferror(in)) result = -1;
+
+    fclose(in);
+    if (fclose(out) != 0) result = -1;
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: fileCopyRange
+// Purpose : Appends `length` bytes of `in`, starting at `offset`, to
+//           `out`; inside the kernel where possible (see fileCopy)
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int fileCopyRange(FILE *in, long long offset, long long length, FILE *out) {
+#if defined(__linux__)
+    if (fflush(out) != 0) return -1;
+    loff_t from = offset;
+    long long copied = 0;
+    while (copied < length) {
+        ssize_t n = copy_file_range(fileno(in), &from, fileno(out), NULL, (size_t)(length - copied), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += n;
+    }
+    if (fseek(out, 0, SEEK_END) != 0) return -1; // stdio picks up where the kernel stopped
+    if (copied == length) return 0;
+    if (copied > 0) return -1; // failed half way through
+#endif
+
+    static unsigned char chunk[1 << 20];
+    while (length > 0) {
+        size_t n = length < (long long)sizeof(chunk) ? (size_t)length : sizeof(chunk);
+        if (fileReadAt(in, offset, chunk, n) != 0 || fwrite(chunk, 1, n, out) != n) return -1;
+        offset += (long long)n;
+        length -= (long long)n;
+    }
+    return 0;
+}
@@ -1,5 +1,7 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #pragma pack(push, 1) 
@@ -29,170 +31,430 @@ typedef struct {
 #pragma pack(pop)
 
 
+// Pixel area of a BMP as described by its headers
+typedef struct {
+    long long offset;  // file offset of the first stored row
+    long long rowSize; // bytes per row incl. padding
+    long long width;
+    long long height;
+    int channels;      // bytes per pixel
+} BMPLayout;
+
+// ------------------------------------------------------------
+// Function: bmpParseHeaders
+// Purpose : Validates the file and info header of a BMP and
+//           locates its pixel rows
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+static int bmpParseHeaders(const unsigned char* headers, long long fileSize, BMPLayout* layout) {
+    if (fileSize < (long long)(sizeof(BMPFileHeader) + sizeof(BMPInfoHeader))) {
+        printf("Not a BMP file!\n");
+        return -1;
+    }
+
+    const BMPFileHeader* fileHeader = (const BMPFileHeader*)headers;
+    const BMPInfoHeader* infoHeader = (const BMPInfoHeader*)(headers + sizeof(BMPFileHeader));
+
+    if (fileHeader->bfType != 0x4D42) { // 'BM' in little endian
+        printf("Not a PNG/BMP file!\n");
+        return -1;
+    }
+
+    int bitCount = infoHeader->biBitCount;
+    if (infoHeader->biCompression != 0 || (bitCount != 24 && bitCount != 32)) {
+        printf("Only uncompressed 24 or 32 bit BMP files are supported.\n");
+        return -1;
+    }
+
+    layout->offset = fileHeader->bfOffBits;
+    layout->width = infoHeader->biWidth;
+    layout->height = llabs((long long)infoHeader->biHeight);
+    layout->rowSize = ((bitCount * layout->width + 31) / 32) * 4; // includes padding
+    layout->channels = bitCount / 8;
+
+    // The pixel rows must lie completely inside the file (divided: the product may overflow)
+    if (layout->width <= 0 || layout->height <= 0 || layout->offset > fileSize ||
+        layout->height > (fileSize - layout->offset) / layout->rowSize) {
+        printf("Corrupted BMP file.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: bmpGeometry
+// Purpose : Describes the pixel area of a BMP held in memory
+//           for the embedding engine
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+static int bmpGeometry(unsigned char* buffer, size_t fileSize, struct pixelGeometry* g) {
+    BMPLayout layout;
+    if (bmpParseHeaders(buffer, (long long)fileSize, &layout) != 0) return -1;
+
+    // Rows are used in storage order (bottom-up for positive heights), like the
+    // original tool did, so older stego images stay readable.
+    // B, G, R carry bits; the 4th byte of 32 bit pixels is skipped.
+    if (geometryInit(g, buffer + layout.offset, layout.rowSize, layout.width, layout.height, layout.channels, 0x7) != 0) {
+        printf("Corrupted BMP file.\n");
+        return -1;
+    }
+    return 0;
+}
+
 // ------------------------------------------------------------
 // Function: embedMessage
 // Purpose : Embed a secret message into a 24-bit BMP image
 // Method  : Least Significant Bit (LSB) modification
 // ------------------------------------------------------------
-void embedMessage(const char* inputImage, const char* outputImage, const char* message) {
-    FILE* in = fopen(inputImage, "rb");
-    if (!in) { printf("Error opening input file.\n"); return; }
+void embedMessage(const char* inputImage, const char* outputImage, const unsigned char* message, size_t msgLen) {
+    // Map the cover read-only. If the output overwrites the input,
+    // work on a private copy instead (the output gets truncated first).
+    struct fileBuffer in;
+    int loaded = fileIsSame(inputImage, outputImage) ? fileReadCopy(inputImage, &in) : fileMapRead(inputImage, &in);
+    if (loaded != 0) { printf("Error opening input file.\n"); return; }
+
+    struct pixelGeometry geometry;
+    if (bmpGeometry(in.data, in.size, &geometry) != 0) {
+        fileClose(&in);
+        return;
+    }
 
-    // Load the entire file into memory
-    fseek(in, 0, SEEK_END);
-    long fileSize = ftell(in);
-    rewind(in);
+    // Capacity check: header + message bits
+    if (payloadStoredLength(msgLen) > payloadCapacity(&geometry)) {
+        printf("Message too long for this image.\n");
+        fileClose(&in);
+        return;
+    }
 
-    unsigned char* buffer = malloc(fileSize);
-    fread(buffer, 1, fileSize, in);
-    fclose(in);
+    // The output is mapped as well: copy the cover over and modify it in place
+    struct fileBuffer out;
+    if (fileMapWrite(outputImage, in.size, &out) != 0) {
+        printf("Error opening output file.\n");
+        fileClose(&in);
+        return;
+    }
+    parallelCopy(out.data, in.data, in.size);
+
+    bmpGeometry(out.data, out.size, &geometry);
+    if (embedPayload(&geometry, message, msgLen) != 0) {
+        // Half an embedding is no use: drop the output, or put the cover
+        // back if the output is the input itself
+        int same = fileIsSame(inputImage, outputImage);
+        if (same) parallelCopy(out.data, in.data, in.size);
+        fileClose(&in);
+        fileClose(&out);
+        if (!same) remove(outputImage);
+        printf("Failed to embed the message.\n");
+        return;
+    }
+    fileClose(&in);
 
-    BMPFileHeader* fileHeader = (BMPFileHeader*)buffer;
-    BMPInfoHeader* infoHeader = (BMPInfoHeader*)(buffer + sizeof(BMPFileHeader));
+    // Update header size values
+    BMPFileHeader* fileHeader = (BMPFileHeader*)out.data;
+    BMPInfoHeader* infoHeader = (BMPInfoHeader*)(out.data + sizeof(BMPFileHeader));
+    fileHeader->bfSize = out.size;
+    infoHeader->biSizeImage = out.size - fileHeader->bfOffBits;
 
-    // Validate BMP file
-    if (fileHeader->bfType != 0x4D42) { // 'BM' in little endian
-        printf("Not a PNG/BMP file!\n");
-        free(buffer);
+    if (fileClose(&out) != 0) {
+        printf("Error writing output file.\n");
         return;
     }
+    printf("Embedded successfully. Created file %s\n", outputImage);
+}
 
-    // Pointer to the start of pixel data
-    unsigned char* pixelData = buffer + fileHeader->bfOffBits;
 
-    int width = infoHeader->biWidth;
-    int height = abs(infoHeader->biHeight);
-    int rowSize = ((infoHeader->biBitCount * width + 31) / 32) * 4; // includes padding
+// ------------------------------------------------------------
+// Function: embedMessageInPlace
+// Purpose : Embed a secret message directly into an existing BMP
+// Method  : The payload occupies the first slots in storage order,
+//           which is one contiguous byte range at the start of the
+//           pixel data. Only that range is read, modified and written
+//           back (pread / pwrite), plus the header size fields if
+//           they need fixing. The rest of the file is never touched.
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int embedMessageInPlace(const char* image, const unsigned char* message, size_t msgLen) {
+    FILE* f = fopen(image, "r+b");
+    if (!f) { printf("Error opening input file.\n"); return -1; }
+
+    unsigned char headers[sizeof(BMPFileHeader) + sizeof(BMPInfoHeader)] = { 0 };
+    long long fileSize = fileSizeOf(f);
+    if (fileSize >= (long long)sizeof(headers) && fileReadAt(f, 0, headers, sizeof(headers)) != 0) {
+        fileSize = -1;
+    }
 
-    int msgLen = strlen(message);
-    int totalBits = 32 + msgLen * 8; // 32 bits for length + message bits
+    BMPLayout layout;
+    if (bmpParseHeaders(headers, fileSize, &layout) != 0) {
+        fclose(f);
+        return -1;
+    }
 
-    // Capacity check: image must have enough pixels to hold the message
-    if (totalBits > width * height * 3) {
+    // Capacity check: header + message bits
+    long long rowSlots = layout.width * 3;
+    if (payloadStoredLength(msgLen) > payloadCapacitySlots((size_t)(rowSlots * layout.height))) {
         printf("Message too long for this image.\n");
-        free(buffer);
-        return;
+        fclose(f);
+        return -1;
+    }
+
+    long long totalBits = PAYLOAD_HEADER_BITS + (long long)payloadStoredLength(msgLen) * 8;
+
+    // Byte range from the first pixel up to the channel holding the last bit
+    long long lastRow = (totalBits - 1) / rowSlots;
+    long long lastSlot = (totalBits - 1) % rowSlots;
+    long long lastByte = layout.channels == 4 ? lastSlot / 3 * 4 + lastSlot % 3 : lastSlot;
+    size_t rangeSize = (size_t)(lastRow * layout.rowSize + lastByte + 1);
+
+    // Some spare bytes behind the range: the kernels load whole vectors
+    unsigned char* range = malloc(rangeSize + 64);
+    if (!range || fileReadAt(f, layout.offset, range, rangeSize) != 0) {
+        printf("Error reading input file.\n");
+        free(range);
+        fclose(f);
+        return -1;
+    }
+
+    struct pixelGeometry geometry;
+    geometryInit(&geometry, range, layout.rowSize, layout.width, lastRow + 1, layout.channels, 0x7);
+    if (embedPayload(&geometry, message, msgLen) != 0) {
+        // Nothing has been written yet, the file stays as it was
+        printf("Failed to embed the message.\n");
+        free(range);
+        fclose(f);
+        return -1;
     }
 
-    // Embed message into pixel data
-    int bitIndex = 0;
-    for (int y = 0; y < height; y++) {
-        unsigned char* row = pixelData + y * rowSize;
-        for (int x = 0; x < width * 3; x++) { // process B, G, R channels
-            if (bitIndex < totalBits) {
-                unsigned char bit;
-                if (bitIndex < 32) {
-                    // First 32 bits store the message length
-                    bit = (msgLen >> bitIndex) & 1;
-                }
-                else {
-                    // Remaining bits store the actual message
-                    int charIndex = (bitIndex - 32) / 8;
-                    int charBit = (bitIndex - 32) % 8;
-                    bit = (message[charIndex] >> charBit) & 1;
-                }
-                row[x] = (row[x] & 0xFE) | bit; // Replace LSB with our bit
-                bitIndex++;
-            }
+    int result = fileWriteAt(f, layout.offset, range, rangeSize);
+    free(range);
+
+    // Same header fixes as a full rewrite would do
+    BMPFileHeader* fileHeader = (BMPFileHeader*)headers;
+    BMPInfoHeader* infoHeader = (BMPInfoHeader*)(headers + sizeof(BMPFileHeader));
+    unsigned int sizeImage = (unsigned int)(fileSize - fileHeader->bfOffBits);
+
+    if (result == 0 && fileHeader->bfSize != (unsigned int)fileSize) {
+        fileHeader->bfSize = (unsigned int)fileSize;
+        result = fileWriteAt(f, offsetof(BMPFileHeader, bfSize), &fileHeader->bfSize, sizeof(fileHeader->bfSize));
+    }
+    if (result == 0 && infoHeader->biSizeImage != sizeImage) {
+        infoHeader->biSizeImage = sizeImage;
+        result = fileWriteAt(f, sizeof(BMPFileHeader) + offsetof(BMPInfoHeader, biSizeImage),
+                             &infoHeader->biSizeImage, sizeof(infoHeader->biSizeImage));
+    }
+
+    if (fclose(f) != 0 || result != 0) {
+        printf("Error writing output file.\n");
+        return -1;
+    }
+
+    printf("Embedded successfully. Updated %zu bytes of file %s\n", rangeSize, image);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: embedMessagePatchCopy
+// Purpose : Like embedMessage, but the cover is copied by the OS
+//           (copy_file_range) and then patched with
+//           embedMessageInPlace instead of being rewritten
+// ------------------------------------------------------------
+void embedMessagePatchCopy(const char* inputImage, const char* outputImage, const unsigned char* message, size_t msgLen) {
+    if (!fileIsSame(inputImage, outputImage)) {
+        if (fileCopy(inputImage, outputImage) != 0) {
+            printf("Error copying %s to %s.\n", inputImage, outputImage);
+            return;
         }
     }
 
-    // Update header size values
-    fileHeader->bfSize = fileSize;
-    infoHeader->biSizeImage = fileSize - fileHeader->bfOffBits;
+    if (embedMessageInPlace(outputImage, message, msgLen) != 0 && !fileIsSame(inputImage, outputImage)) {
+        remove(outputImage); // don't leave an unmodified copy behind
+    }
+}
+
+// ------------------------------------------------------------
+// Function: bmpExtractRange
+// Purpose : Extracts nBits slot LSBs starting at firstSlot straight
+//           from the file: only the stored rows holding those slots
+//           are read, in row-aligned chunks of about 1 MB (pread)
+// Returns : 0 on success, -1 on read errors
+// ------------------------------------------------------------
+static int bmpExtractRange(FILE* f, const BMPLayout* layout, long long firstSlot, long long nBits, unsigned char* out) {
+    long long rowSlots = layout->width * 3;
+    long long rowsPerChunk = (1 << 20) / layout->rowSize;
+    if (rowsPerChunk < 1) rowsPerChunk = 1;
+
+    // Spare bytes behind the chunk: the kernels load whole vectors
+    unsigned char* chunk = malloc(rowsPerChunk * layout->rowSize + 64);
+    if (!chunk) return -1;
+
+    long long row = firstSlot / rowSlots;
+    long long slot = firstSlot % rowSlots;
+    long long bitPos = 0;
+
+    while (bitPos < nBits) {
+        long long rows = (slot + (nBits - bitPos) + rowSlots - 1) / rowSlots;
+        if (rows > rowsPerChunk) rows = rowsPerChunk;
+
+        if (fileReadAt(f, layout->offset + row * layout->rowSize, chunk, rows * layout->rowSize) != 0) {
+            free(chunk);
+            return -1;
+        }
+
+        long long count = rows * rowSlots - slot;
+        if (count > nBits - bitPos) count = nBits - bitPos;
 
-    // Write modified BMP to output file
-    FILE* out = fopen(outputImage, "wb");
-    if (!out) { printf("Error opening output file.\n"); free(buffer); return; }
-    fwrite(buffer, 1, fileSize, out);
-    fclose(out);
+        struct pixelGeometry geometry;
+        geometryInit(&geometry, chunk, layout->rowSize, layout->width, rows, layout->channels, 0x7);
+        geometryExtractBits(&geometry, slot, out, bitPos, count);
 
+        bitPos += count;
+        row += rows;
+        slot = 0;
+    }
+
+    free(chunk);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: bmpExtractBytes
+// Purpose : bmpExtractRange for whole payload bytes. Big ranges are
+//           split into byte ranges whose rows are computed directly;
+//           worker threads read them (pread) and gather the bits
+//           into their part of `out`.
+// Returns : 0 on success, -1 on read errors
+// ------------------------------------------------------------
+#define BMP_GATHER_BYTES (1 << 20)
+
+struct bmpGather {
+    FILE* f;
+    const BMPLayout* layout;
+    long long firstSlot;
+    size_t bytes;
+    unsigned char* out;
+    atomic_int failed;          // set by any worker
+};
+
+static void bmpGatherPart(void* ctx, int index, int count) {
+    struct bmpGather* job = ctx;
+    size_t begin = job->bytes / count * index;
+    size_t end = index == count - 1 ? job->bytes : job->bytes / count * (index + 1);
+
+    // own buffer: the kernels write the stream in 64 bit words
+    unsigned char* buffer = malloc(BMP_GATHER_BYTES + LSB_STREAM_PADDING);
+    if (!buffer) { atomic_store(&job->failed, 1); return; }
+
+    for (size_t pos = begin; pos < end;) {
+        size_t n = end - pos < BMP_GATHER_BYTES ? end - pos : BMP_GATHER_BYTES;
+        if (bmpExtractRange(job->f, job->layout, job->firstSlot + (long long)pos * 8, (long long)n * 8, buffer) != 0) {
+            atomic_store(&job->failed, 1);
+            break;
+        }
+        memcpy(job->out + pos, buffer, n);
+        pos += n;
+    }
     free(buffer);
-    printf("Embedded successfully. Created file %s\n", outputImage);
 }
 
+static int bmpExtractBytes(FILE* f, const BMPLayout* layout, long long firstSlot, size_t bytes, unsigned char* out) {
+#ifdef FILEIO_MMAP
+    int parts = threadsFor(bytes * 8, GEOMETRY_BAND_SLOTS);
+#else
+    int parts = 1; // seek + read on a shared FILE can't run in parallel
+#endif
+    if (parts <= 1) return bmpExtractRange(f, layout, firstSlot, (long long)bytes * 8, out);
+
+    struct bmpGather job = { .f = f, .layout = layout, .firstSlot = firstSlot, .bytes = bytes, .out = out };
+    parallelRun(parts, bmpGatherPart, &job);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+// Extraction from a file that can't be read at offsets (pipes etc.)
+static unsigned char* bmpExtractBuffered(const char* inputImage, size_t* msgLen) {
+    struct fileBuffer in;
+    if (fileMapRead(inputImage, &in) != 0) { printf("Error opening file.\n"); return NULL; }
+
+    struct pixelGeometry geometry;
+    if (bmpGeometry(in.data, in.size, &geometry) != 0) {
+        fileClose(&in);
+        return NULL;
+    }
+
+    unsigned char* message;
+    int found = extractPayload(&geometry, &message, msgLen);
+    fileClose(&in);
+
+    if (found == 0) {
+        printf("Invalid or corrupted message header.\n"); // otherwise payloadUnpack said why
+    }
+    return message;
+}
 
 // ------------------------------------------------------------
 // Function: extractMessage
 // Purpose : Extract a hidden message from a 24-bit BMP image
-// Method  : Reads the LSBs of pixel data
+// Method  : Reads the LSBs of pixel data. Only the headers and the
+//           rows holding the length + message are read from disk,
+//           so the cost depends on the message, not the image size.
 // ------------------------------------------------------------
 void extractMessage(const char* inputImage, const char* outputFile) {
     FILE* in = fopen(inputImage, "rb");
     if (!in) { printf("Error opening file.\n"); return; }
 
-    // Load entire file into memory
-    fseek(in, 0, SEEK_END);
-    long fileSize = ftell(in);
-    rewind(in);
-
-    unsigned char* buffer = malloc(fileSize);
-    fread(buffer, 1, fileSize, in);
-    fclose(in);
-
-    BMPFileHeader* fileHeader = (BMPFileHeader*)buffer;
-    BMPInfoHeader* infoHeader = (BMPInfoHeader*)(buffer + sizeof(BMPFileHeader));
-
-    // Validate BMP file
-    if (fileHeader->bfType != 0x4D42) {
-        printf("Not a BMP file!\n");
-        free(buffer);
-        return;
-    }
-
-    unsigned char* pixelData = buffer + fileHeader->bfOffBits;
-
-    int width = infoHeader->biWidth;
-    int height = abs(infoHeader->biHeight);
-    int rowSize = ((infoHeader->biBitCount * width + 31) / 32) * 4;
+    long long fileSize = fileSizeOf(in);
+    size_t msgLen = 0;
+    unsigned char* message = NULL;
 
-    // -------------------------------
-    // Step 1: Read message length (32 bits)
-    // -------------------------------
-    int msgLen = 0;
-    int bitCount = 0;
+    if (fileSize < 0) {
+        // not a regular file, read it as a whole
+        fclose(in);
+        message = bmpExtractBuffered(inputImage, &msgLen);
+        if (message == NULL) return;
+    } else {
+        unsigned char headers[sizeof(BMPFileHeader) + sizeof(BMPInfoHeader)] = { 0 };
+        if (fileSize >= (long long)sizeof(headers) && fileReadAt(in, 0, headers, sizeof(headers)) != 0) {
+            fileSize = -1;
+        }
 
-    for (int y = 0; y < height && bitCount < 32; y++) {
-        unsigned char* row = pixelData + y * rowSize;
-        for (int x = 0; x < width * 3 && bitCount < 32; x++) {
-            unsigned char bit = row[x] & 1;
-            msgLen |= (bit << bitCount);
-            bitCount++;
+        BMPLayout layout;
+        if (bmpParseHeaders(headers, fileSize, &layout) != 0) {
+            fclose(in);
+            return;
         }
-    }
 
-    if (msgLen <= 0 || msgLen > 1000000) {
-        printf("Invalid or corrupted message length: %d\n", msgLen);
-        free(buffer);
-        return;
-    }
+        // -------------------------------
+        // Step 1: Read the header (32 bits tell its size, see payloadHeaderBits)
+        // -------------------------------
+        unsigned char header[PAYLOAD_HEADER_BYTES + LSB_STREAM_PADDING];
+        size_t totalSlots = (size_t)(layout.width * 3 * layout.height);
+        struct payloadHeader h;
+        if (bmpExtractRange(in, &layout, 0, PAYLOAD_LEGACY_BITS, header) != 0 ||
+            (payloadHeaderBits(header) > PAYLOAD_LEGACY_BITS &&
+             bmpExtractRange(in, &layout, PAYLOAD_LEGACY_BITS, payloadHeaderBits(header) - PAYLOAD_LEGACY_BITS, header + 4) != 0)) {
+            printf("Error reading file.\n");
+            fclose(in);
+            return;
+        }
 
-    // -------------------------------
-    // Step 2: Read message content
-    // -------------------------------
-    char* message = malloc(msgLen + 1);
-    memset(message, 0, msgLen + 1);
-
-    int charIndex = 0, charBit = 0;
-    int bitsRead = 0;
-    int startBit = 32; // skip first 32 bits (length)
-
-    for (int y = 0; y < height && charIndex < msgLen; y++) {
-        unsigned char* row = pixelData + y * rowSize;
-        for (int x = 0; x < width * 3 && charIndex < msgLen; x++) {
-            int globalBit = y * width * 3 + x;
-            if (globalBit >= startBit) {
-                unsigned char bit = row[x] & 1;
-                message[charIndex] |= (bit << charBit);
-                charBit++;
-                if (charBit == 8) {
-                    charBit = 0;
-                    charIndex++;
-                }
-                bitsRead++;
-                if (bitsRead >= msgLen * 8) break; // stop after full message
-            }
+        if (payloadParseHeader(header, totalSlots, &h) != 0) {
+            printf("Invalid or corrupted message length: %llu\n", (unsigned long long)h.length);
+            fclose(in);
+            return;
+        }
+        msgLen = (size_t)h.length;
+
+        // -------------------------------
+        // Step 2: Read message content (the rows right behind the header)
+        // -------------------------------
+        message = streamAlloc(msgLen + 1);
+        if (!message || bmpExtractBytes(in, &layout, h.headerBits, msgLen, message) != 0) {
+            printf("Error reading file.\n");
+            free(message);
+            fclose(in);
+            return;
         }
+        fclose(in);
+
+        if (payloadUnpack(h.flags, &message, &msgLen) != 0) return;
     }
 
     if (outputFile != NULL) {
@@ -200,43 +462,39 @@ void extractMessage(const char* inputImage, const char* outputFile) {
         if (out) {
             fwrite(message, 1, msgLen, out);
             fclose(out);
-            printf("Successfully extracted content to '%s' (%d bytes).\n", outputFile, msgLen);
+            printf("Successfully extracted content to '%s' (%zu bytes).\n", outputFile, msgLen);
         } else {
             printf("Error writing output file.\n");
         }
     } else {
-        printf("Extracted content:\n%s\n", message);
+        printf("Extracted content:\n");
+        fwrite(message, 1, msgLen, stdout);
+        printf("\n");
     }
 
     free(message);
-    free(buffer);
 }
 
 // ------------------------------------------------------------
 // Function: getBmpCapacity
 // Purpose : Calculates the maximum message size (in bytes) that fits in the image
-// Method  : Reads file headers to obtain dimensions: (Width * Height * 3 - 32) / 8
+// Method  : Reads file headers to obtain dimensions: (Width * Height * 3 - 128) / 8 - 4 (header, checksum)
 // ------------------------------------------------------------
 long getBmpCapacity(const char* inputImage) {
     FILE* in = fopen(inputImage, "rb");
     if (!in) { return -1; }
 
-    BMPFileHeader fileHeader;
-    BMPInfoHeader infoHeader;
-
-    // Nur die Header lesen
-    if (fread(&fileHeader, sizeof(BMPFileHeader), 1, in) != 1) { fclose(in); return -1; }
-    if (fread(&infoHeader, sizeof(BMPInfoHeader), 1, in) != 1) { fclose(in); return -1; }
+    // Nur die Header lesen, aber genauso prüfen wie beim Einbetten
+    unsigned char headers[sizeof(BMPFileHeader) + sizeof(BMPInfoHeader)] = { 0 };
+    long long fileSize = fileSizeOf(in);
+    if (fileSize >= (long long)sizeof(headers) && fileReadAt(in, 0, headers, sizeof(headers)) != 0) {
+        fileSize = -1;
+    }
     fclose(in);
 
-    if (fileHeader.bfType != 0x4D42) { return -1; } // Kein BMP
-
-    long width = infoHeader.biWidth;
-    long height = abs(infoHeader.biHeight);
-
-    // Formel: (Pixel * 3 Farbkanäle - 32 Bits für Länge) / 8 Bits pro Byte
-    long maxBits = (width * height * 3) - 32;
+    BMPLayout layout;
+    if (bmpParseHeaders(headers, fileSize, &layout) != 0) return -1;
 
-    if (maxBits < 0) return 0;
-    return maxBits / 8;
+    // Formel: (Pixel * 3 Farbkanäle - Header-Bits) / 8 Bits pro Byte - Prüfsumme
+    return (long)payloadMessageCapacity((size_t)(layout.width * layout.height * 3));
 }
\ No newline at end of file
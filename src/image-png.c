@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,7 +10,304 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-void embedMessagePNG(const char* inputImage, const char* outputImage, const char* message) {
+// ------------------------------------------------------------
+// Palette images
+// Bits go into the lowest bit of the palette indices, so a changed
+// bit swaps a pixel between colors 2k and 2k + 1. To keep that swap
+// invisible the palette is reordered first (EzStego style) so that
+// both colors of a pair are close. A pair costs its color distance
+// times the number of pixels using it: the cheapest pairs are taken
+// first, then pairs swap partners while that lowers the total. A
+// color left over (odd palette) is paired with a copy of itself.
+// ------------------------------------------------------------
+static uint64_t paletteCost(const struct pngPalette* p, const size_t* counts, int a, int b) {
+    uint64_t distance = 0;
+    for (int c = 0; c < 3; c++) {
+        int d = p->colors[3 * a + c] - p->colors[3 * b + c];
+        distance += d * d;
+    }
+    int alphaA = a < p->alphaSize ? p->alpha[a] : 255, alphaB = b < p->alphaSize ? p->alpha[b] : 255;
+    distance += (alphaA - alphaB) * (alphaA - alphaB);
+    return distance * (counts[a] + counts[b]);
+}
+
+// Builds the embedding order of `in` for the given index counts:
+// out = reordered palette, remap[old index] = new index
+static void paletteOrder(const struct pngPalette* in, const size_t* counts, struct pngPalette* out,
+                         unsigned char remap[256]) {
+    int order[257], used[256] = { 0 };
+    int size = 0;
+
+    while (size + 1 < in->size) {
+        int bestA = -1, bestB = -1;
+        uint64_t bestCost = 0;
+        for (int a = 0; a < in->size; a++) {
+            if (used[a]) continue;
+            for (int b = a + 1; b < in->size; b++) {
+                if (used[b]) continue;
+                uint64_t cost = paletteCost(in, counts, a, b);
+                if (bestA < 0 || cost < bestCost) {
+                    bestA = a;
+                    bestB = b;
+                    bestCost = cost;
+                }
+            }
+        }
+        used[bestA] = used[bestB] = 1;
+        order[size++] = bestA;
+        order[size++] = bestB;
+    }
+
+    // Swap partners between two pairs while that is cheaper
+    int pairs = size / 2;
+    for (int improved = 1; improved;) {
+        improved = 0;
+        for (int p = 0; p < pairs; p++) {
+            for (int q = p + 1; q < pairs; q++) {
+                int a = order[2 * p], b = order[2 * p + 1], c = order[2 * q], d = order[2 * q + 1];
+                uint64_t now = paletteCost(in, counts, a, b) + paletteCost(in, counts, c, d);
+                uint64_t cross = paletteCost(in, counts, a, c) + paletteCost(in, counts, b, d);
+                uint64_t twist = paletteCost(in, counts, a, d) + paletteCost(in, counts, b, c);
+                if (cross < now && cross <= twist) {
+                    order[2 * p + 1] = c;
+                    order[2 * q] = b;
+                    improved = 1;
+                } else if (twist < now) {
+                    order[2 * p + 1] = d;
+                    order[2 * q + 1] = b;
+                    improved = 1;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < in->size; i++) {
+        if (!used[i]) {
+            order[size++] = i;
+            order[size++] = i;
+        }
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->size = size;
+    for (int k = size - 1; k >= 0; k--) { // downwards: tRNS ends at the last translucent entry
+        int i = order[k];
+        remap[i] = (unsigned char)k;
+        memcpy(out->colors + 3 * k, in->colors + 3 * i, 3);
+        out->alpha[k] = i < in->alphaSize ? in->alpha[i] : 255;
+        if (out->alpha[k] != 255 && out->alphaSize == 0) out->alphaSize = k + 1;
+    }
+}
+
+// ------------------------------------------------------------
+// Function: embedCopyFrom
+// Purpose : Once the payload is in (all rows before `row`), finds
+//           the segment from which on the input's compressed data
+//           can be copied into `out` unchanged: the rows after the
+//           payload have to stay the same (no palette change, no
+//           expansion to RGB) and both files have to be cut into the
+//           same segments (input written by us, see pngStreamCopy)
+// Returns : The segment, or -1 if everything has to be encoded
+// ------------------------------------------------------------
+static int embedCopyFrom(const struct pngReader* reader, const struct pngStream* out,
+                         const struct pngPalette* palette, const unsigned char* remap, int row) {
+    if (reader->colorType == PNG_PALETTE && !reader->keepIndices) return -1;
+    if (palette && (palette->size != reader->palette.size || palette->alphaSize != reader->palette.alphaSize ||
+                    memcmp(palette->colors, reader->palette.colors, 3 * (size_t)palette->size) != 0 ||
+                    memcmp(palette->alpha, reader->palette.alpha, (size_t)palette->alphaSize) != 0)) {
+        return -1;
+    }
+    for (int i = 0; remap && i < 256; i++) {
+        if (remap[i] != i) return -1;
+    }
+    if (reader->segmentCount != out->segmentCount ||
+        memcmp(reader->segmentRows, out->segmentRows, (reader->segmentCount + 1) * sizeof(int)) != 0) {
+        return -1;
+    }
+
+    int k = 0;
+    while (k < reader->segmentCount && reader->segmentRows[k] < row) k++;
+    return pngSegmentsCopyable(reader, k) ? k : -1;
+}
+
+// ------------------------------------------------------------
+// Function: embedStreamed
+// Purpose : Embeds row by row: every row is read, gets its share of
+//           the message bits and goes straight into the PNG stream
+//           writer, so memory doesn't grow with the image. Palette
+//           images (reader in index mode) are written with `palette`
+//           after mapping the indices through `remap`.
+//           Closes the reader.
+// Method  : Re-embedding into a file we wrote: the segments after
+//           the payload are copied without decoding (embedCopyFrom),
+//           so the work depends on the payload, not on the image
+// Returns : 0 on success, -1 = the image data couldn't be decoded
+//           (use stb_image), -2 = the output couldn't be written
+// ------------------------------------------------------------
+static int embedStreamed(struct pngReader* reader, const char* outputImage, const unsigned char* message,
+                         size_t msgLen, const struct pngPalette* palette, const unsigned char* remap) {
+    int width = reader->width, height = reader->height, channels = reader->channels;
+    size_t rowBytes = (size_t)width * channels;
+    size_t bits = PAYLOAD_HEADER_BITS + payloadStoredLength(msgLen) * 8, done = 0;
+    int reuse = reader->colorType == PNG_PALETTE && !reader->keepIndices ? PNG_FILTERS_CHOOSE : pngFilterReuse;
+
+    unsigned char* stream = payloadStream(message, msgLen);
+    unsigned char* pixels = malloc(rowBytes);
+    struct pngStream out;
+    if (!stream || !pixels || pngStreamOpen(&out, outputImage, width, height, channels, palette) != 0) {
+        free(stream);
+        free(pixels);
+        pngClose(reader);
+        return -2;
+    }
+
+    int result = 0, copyFrom = -1;
+    for (int y = 0; y < height; y++) {
+        if (copyFrom >= 0 && y == reader->segmentRows[copyFrom]) {
+            for (int k = copyFrom; k < reader->segmentCount && result == 0; k++) {
+                if (pngStreamCopy(&out, reader->file, reader->segmentOffsets[k], reader->segmentAdlers[k]) != 0) {
+                    result = -2;
+                }
+            }
+            break;
+        }
+
+        unsigned char* row = pngReadRow(reader);
+        struct pixelGeometry geometry;
+        if (row == NULL || geometryInit(&geometry, pixels, rowBytes, width, 1, channels, palette ? 0x1 : 0x7) != 0) {
+            result = -1;
+            break;
+        }
+
+        if (remap) {
+            for (int x = 0; x < width; x++) pixels[x] = remap[row[x]];
+        } else {
+            memcpy(pixels, row, rowBytes);
+        }
+
+        size_t n = bits - done < geometry.rowSlots ? bits - done : geometry.rowSlots;
+        if (n > 0) geometryEmbedBits(&geometry, 0, stream, done, n);
+        done += n;
+
+        int filter = reuse == PNG_FILTERS_REUSE || (reuse == PNG_FILTERS_REUSE_TAIL && n == 0) ? reader->filter : -1;
+        if (pngStreamRow(&out, pixels, filter) != 0) {
+            result = -2;
+            break;
+        }
+        if (n > 0 && done == bits) copyFrom = embedCopyFrom(reader, &out, palette, remap, y + 1);
+    }
+    pngClose(reader); // before the output replaces a file that is also the input
+
+    if (result != 0) {
+        pngStreamFree(&out);
+    } else if (pngStreamClose(&out) != 0) {
+        result = -2;
+    }
+    free(stream);
+    free(pixels);
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: embedIndexed
+// Purpose : Embeds into the palette indices of an 8 bit palette PNG
+//           and writes it back as a palette PNG
+// Method  : A first pass counts the indices for paletteOrder, the
+//           second one embeds (embedStreamed)
+// Returns : 0 on success, 1 = the message doesn't fit the indices,
+//           -1 = not an image for this path (use another one),
+//           -2 = the output couldn't be written
+// ------------------------------------------------------------
+static int embedIndexed(const char* inputImage, const char* outputImage, const unsigned char* message, size_t msgLen) {
+    struct pngReader reader;
+    if (pngOpen(&reader, inputImage) != 0) return -1;
+    if (reader.colorType != PNG_PALETTE) {
+        pngClose(&reader);
+        return -1;
+    }
+    pngKeepIndices(&reader);
+
+    if (payloadCapacitySlots((size_t)reader.width * reader.height) < payloadStoredLength(msgLen)) {
+        pngClose(&reader);
+        return 1;
+    }
+
+    size_t counts[256] = { 0 };
+    int result = 0;
+    for (int y = 0; y < reader.height; y++) {
+        unsigned char* row = pngReadRow(&reader);
+        if (row == NULL) {
+            result = -1;
+            break;
+        }
+        for (int x = 0; x < reader.width; x++) counts[row[x]]++;
+    }
+    struct pngPalette original = reader.palette;
+    pngClose(&reader);
+
+    for (int i = original.size; i < 256 && result == 0; i++) {
+        if (counts[i] != 0) result = -1; // index outside the palette: let stb_image judge the file
+    }
+    if (result != 0) return result;
+
+    unsigned char remap[256];
+    struct pngPalette palette;
+    paletteOrder(&original, counts, &palette, remap);
+
+    if (pngOpen(&reader, inputImage) != 0) return -1;
+    pngKeepIndices(&reader);
+    return embedStreamed(&reader, outputImage, message, msgLen, &palette, remap);
+}
+
+// ------------------------------------------------------------
+// Function: embedTruecolor
+// Purpose : Streamed embedding into the R, G, B bits of an image the
+//           streaming reader can decode (palette images are expanded
+//           to RGB, unless they have transparency)
+// Returns : as embedIndexed (1 = the message doesn't fit the image)
+// ------------------------------------------------------------
+static int embedTruecolor(const char* inputImage, const char* outputImage, const unsigned char* message, size_t msgLen) {
+    struct pngReader reader;
+    if (pngOpen(&reader, inputImage) != 0) return -1;
+    if (reader.colorType == PNG_PALETTE && reader.palette.alphaSize > 0) {
+        pngClose(&reader); // stb_image keeps the alpha channel for these
+        return -1;
+    }
+
+    if (payloadCapacitySlots((size_t)reader.width * reader.height * 3) < payloadStoredLength(msgLen)) {
+        pngClose(&reader);
+        return 1;
+    }
+    return embedStreamed(&reader, outputImage, message, msgLen, NULL, NULL);
+}
+
+// Streamed embedding: palette indices first, then truecolor
+// (same return values as embedIndexed)
+static int embedPNGStreamed(const char* inputImage, const char* outputImage, const unsigned char* message,
+                            size_t msgLen, int verbose) {
+    int result = embedIndexed(inputImage, outputImage, message, msgLen);
+    if (result == 1 && verbose) printf("Message too long for the palette indices, writing a truecolor PNG.\n");
+    if (result == 1 || result == -1) result = embedTruecolor(inputImage, outputImage, message, msgLen);
+    return result;
+}
+
+void embedMessagePNG(const char* inputImage, const char* outputImage, const unsigned char* message, size_t msgLen) {
+    // Palettenbilder bleiben Palettenbilder, solange die Nachricht in die Indizes passt;
+    // zeilenweise, wenn der eigene Reader das Bild kann, sonst ganz mit stb_image
+    int streamed = embedPNGStreamed(inputImage, outputImage, message, msgLen, 1);
+    if (streamed == 0) {
+        printf("Embedded successfully. Created file %s\n", outputImage);
+        return;
+    }
+    if (streamed == 1) {
+        printf("Message too long for this image.\n");
+        return;
+    }
+    if (streamed == -2) {
+        printf("Failed to write output PNG.\n");
+        return;
+    }
+
     int width, height, channels;
     unsigned char* img = stbi_load(inputImage, &width, &height, &channels, 0);
     if (img == NULL) {
@@ -23,24 +321,16 @@ void embedMessagePNG(const char* inputImage, const char* outputImage, const char
         return;
     }
 
-    int msgLen = strlen(message);
-    int totalBits = 32 + msgLen * 8;
-    int bitIndex = 0;
-
-    for (int i = 0; i < width * height * channels; i++) {
-        if (channels == 4 && (i % 4 == 3)) continue; // Skip Alpha
-
-        if (bitIndex < totalBits) {
-            unsigned char bit;
-            if (bitIndex < 32) bit = (msgLen >> bitIndex) & 1;
-            else bit = (message[(bitIndex - 32) / 8] >> ((bitIndex - 32) % 8)) & 1;
-
-            img[i] = (img[i] & 0xFE) | bit;
-            bitIndex++;
-        } else break;
+    // Pixels are stored without padding; R, G, B carry bits, alpha is skipped
+    struct pixelGeometry geometry;
+    if (geometryInit(&geometry, img, (long long)width * channels, width, height, channels, 0x7) != 0 ||
+        embedPayload(&geometry, message, msgLen) != 0) {
+        printf("Message too long for this image.\n");
+        stbi_image_free(img);
+        return;
     }
 
-    if (!stbi_write_png(outputImage, width, height, channels, img, width * channels)) {
+    if (pngWrite(outputImage, img, width, height, channels, NULL) != 0) {
         printf("Failed to write output PNG.\n");
     } else {
         printf("Embedded successfully. Created file %s\n", outputImage);
@@ -48,38 +338,208 @@ void embedMessagePNG(const char* inputImage, const char* outputImage, const char
     stbi_image_free(img);
 }
 
-void extractMessagePNG(const char* inputImage, const char* outputFile) {
-    int width, height, channels;
-    unsigned char* img = stbi_load(inputImage, &width, &height, &channels, 0);
-    if (!img) { printf("Error loading PNG.\n"); return; }
+// ------------------------------------------------------------
+// Parallel extraction over the segments of a stIX index
+// Each segment is decoded by its own reader and gathers its bits
+// into a buffer of its own, because the kernels update the message
+// with 64 bit read-modify-writes. Whole bytes are then copied over;
+// the two edge bytes a segment may share with its neighbours are
+// merged with an atomic OR (the message starts out zeroed).
+// ------------------------------------------------------------
+struct segmentJob {
+    const struct pngReader* reader;
+    int mask;
+    size_t rowSlots;
+    unsigned char* message;
+    size_t headerBits, needed;   // payload bits, header included
+    int firstRow, lastRow;       // rows still to be read
+    int firstSegment, lastSegment;
+    atomic_int failed;          // set by any worker
+};
+
+static int extractSegment(struct segmentJob* job, int k) {
+    struct pngReader reader;
+    if (pngSegmentOpen(job->reader, k, &reader) != 0) return -1;
+
+    int begin = reader.row > job->firstRow ? reader.row : job->firstRow;
+    int end = reader.height < job->lastRow ? reader.height : job->lastRow;
+    size_t last = (size_t)end * job->rowSlots < job->needed ? (size_t)end * job->rowSlots : job->needed;
+    size_t lo = (size_t)begin * job->rowSlots - job->headerBits, hi = last - job->headerBits;
+    size_t base = lo / 8 * 8, bytes = (hi - base + 7) / 8;
 
-    int msgLen = 0, bitIndex = 0, i = 0;
+    unsigned char* local = streamAlloc(bytes);
+    int result = local ? 0 : -1;
+    for (int y = reader.row; y < end && result == 0; y++) {
+        unsigned char* row = pngReadRow(&reader);
+        struct pixelGeometry geometry;
+        if (row == NULL || geometryInit(&geometry, row, (long long)reader.width * reader.channels,
+                                        reader.width, 1, reader.channels, job->mask) != 0) {
+            result = -1;
+        } else if (y >= begin) {
+            size_t slot = (size_t)y * job->rowSlots;
+            size_t n = job->needed - slot < job->rowSlots ? job->needed - slot : job->rowSlots;
+            geometryExtractBits(&geometry, 0, local, slot - job->headerBits - base, n);
+        }
+    }
+    pngClose(&reader);
 
-    // Länge lesen
-    while (bitIndex < 32 && i < width * height * channels) {
-        if (channels == 4 && (i % 4 == 3)) { i++; continue; }
-        msgLen |= ((img[i] & 1) << bitIndex);
-        bitIndex++; i++;
+    if (result == 0) {
+        unsigned char* target = job->message + base / 8;
+        __atomic_fetch_or(&target[0], local[0], __ATOMIC_RELAXED);
+        if (bytes > 1) __atomic_fetch_or(&target[bytes - 1], local[bytes - 1], __ATOMIC_RELAXED);
+        if (bytes > 2) memcpy(target + 1, local + 1, bytes - 2);
     }
+    free(local);
+    return result;
+}
 
-    if (msgLen <= 0 || msgLen > 10000) {
-        printf("No message found or invalid length.\n");
-        stbi_image_free(img);
-        return;
+static void extractSegmentPart(void* ctx, int index, int count) {
+    struct segmentJob* job = ctx;
+    for (int k = job->firstSegment + index; k <= job->lastSegment; k += count) {
+        if (extractSegment(job, k) != 0) atomic_store(&job->failed, 1);
+    }
+}
+
+// Extracts the payload bits from the row `reader` is at up to bit
+// `needed`; 0 on success, -1 if it didn't work out
+static int extractSegments(const struct pngReader* reader, int mask, size_t rowSlots, unsigned char* message,
+                           size_t headerBits, size_t needed) {
+    struct segmentJob job = {
+        .reader = reader,
+        .mask = mask,
+        .rowSlots = rowSlots,
+        .message = message,
+        .headerBits = headerBits,
+        .needed = needed,
+        .firstRow = reader->row,
+        .lastRow = (int)((needed + rowSlots - 1) / rowSlots),
+    };
+
+    for (int k = 0; k < reader->segmentCount; k++) {
+        if (reader->segmentRows[k] <= job.firstRow) job.firstSegment = k;
+        if (reader->segmentRows[k] < job.lastRow) job.lastSegment = k;
+    }
+
+    int parts = threadsFor(job.lastSegment - job.firstSegment + 1, 1);
+    if (parts <= 1) return -1; // the caller's serial loop is just as fast
+    parallelRun(parts, extractSegmentPart, &job);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+// ------------------------------------------------------------
+// Function: extractStreamed
+// Purpose : Reads rows with the streaming reader only until the
+//           header and the message bits are complete
+// Returns : 1 = message found, 0 = no valid message header,
+//           -1 = the reader can't decode this file (use stb_image),
+//           -2 = the content behind the header was rejected (the
+//           reason has been printed by payloadUnpack)
+// ------------------------------------------------------------
+static int extractStreamed(const char* inputImage, unsigned char** message, size_t* msgLen) {
+    struct pngReader reader;
+    if (pngOpen(&reader, inputImage) != 0) return -1;
+
+    // Palette images carry one bit per index (see embedIndexed), everything else R, G and B
+    pngKeepIndices(&reader);
+    int mask = reader.channels == 1 ? 0x1 : 0x7;
+
+    unsigned char header[PAYLOAD_HEADER_BYTES + LSB_STREAM_PADDING];
+    size_t totalSlots = (size_t)reader.width * reader.height * (reader.channels == 1 ? 1 : 3);
+    size_t headerBits = PAYLOAD_LEGACY_BITS; // until the first 32 bits tell otherwise
+    size_t needed = headerBits, done = 0;
+    int result = 1, triedSegments = 0, flags = 0;
+
+    *message = NULL;
+    while (done < needed) {
+        unsigned char* row = pngReadRow(&reader);
+        struct pixelGeometry geometry;
+        if (row == NULL || geometryInit(&geometry, row, (long long)reader.width * reader.channels,
+                                        reader.width, 1, reader.channels, mask) != 0) {
+            result = -1;
+            break;
+        }
+
+        for (size_t slot = 0; slot < geometry.rowSlots && done < needed;) {
+            size_t n = geometry.rowSlots - slot;
+            if (done < headerBits) {
+                if (n > headerBits - done) n = headerBits - done;
+                geometryExtractBits(&geometry, slot, header, done, n);
+            } else {
+                if (n > needed - done) n = needed - done;
+                geometryExtractBits(&geometry, slot, *message, done - headerBits, n);
+            }
+            slot += n;
+            done += n;
+
+            if (done == PAYLOAD_LEGACY_BITS && *message == NULL) {
+                headerBits = payloadHeaderBits(header);
+                needed = headerBits;
+            }
+
+            // header complete: now we know how far to read
+            if (done == headerBits && *message == NULL) {
+                struct payloadHeader h;
+                if (payloadParseHeader(header, totalSlots, &h) != 0 ||
+                    (*message = streamAlloc((size_t)h.length + 1)) == NULL) {
+                    result = 0;
+                    break;
+                }
+                *msgLen = (size_t)h.length;
+                flags = h.flags;
+                needed += (size_t)h.length * 8;
+            }
+        }
+        if (result == 0) break;
+
+        // header known and rows left: with an index the rest can be decoded in parallel
+        if (*message != NULL && done < needed && reader.segmentCount > 0 && !triedSegments) {
+            triedSegments = 1;
+            if (extractSegments(&reader, mask, geometry.rowSlots, *message, headerBits, needed) == 0) done = needed;
+        }
     }
 
-    char* message = calloc(msgLen + 1, 1);
-    int charIdx = 0, charBit = 0;
+    if (result == 1 && payloadUnpack(flags, message, msgLen) != 0) result = -2;
+    if (result != 1) {
+        free(*message);
+        *message = NULL;
+    }
+    pngClose(&reader);
+    return result;
+}
+
+void extractMessagePNG(const char* inputImage, const char* outputFile) {
+    int width, height, channels;
+    unsigned char* img = NULL;
+    size_t msgLen = 0;
+    unsigned char* message = NULL;
 
-    // Nachricht lesen
-    while (charIdx < msgLen && i < width * height * channels) {
-        if (channels == 4 && (i % 4 == 3)) { i++; continue; }
+    // Zuerst nach einem stEg-Chunk schauen (nur Chunk-Header lesen), dann in den Pixeln suchen:
+    // nur so viele Zeilen dekodieren wie nötig, sonst das ganze Bild mit stb_image.
+    // Ein ungültiger stEg-Chunk ist endgültig (Fehlermeldung kommt von extractChunkPNG)
+    int found = extractChunkPNG(inputImage, &message, &msgLen);
+    if (found < 0) return;
+    if (found == 0) found = extractStreamed(inputImage, &message, &msgLen);
+    if (found == -1) {
+        img = stbi_load(inputImage, &width, &height, &channels, 0);
+        if (!img) { printf("Error loading PNG.\n"); return; }
 
-        if (img[i] & 1) message[charIdx] |= (1 << charBit);
+        // Header und Nachricht lesen
+        struct pixelGeometry geometry;
+        found = 0;
+        if (channels >= 3 && geometryInit(&geometry, img, (long long)width * channels, width, height, channels, 0x7) == 0) {
+            found = extractPayload(&geometry, &message, &msgLen);
+        }
+    }
 
-        charBit++;
-        if (charBit == 8) { charBit = 0; charIdx++; }
-        i++;
+    // Bei abgelehntem Inhalt (falscher Schlüssel, Prüfsumme) kam die Meldung schon von payloadUnpack
+    if (found < 0) {
+        stbi_image_free(img);
+        return;
+    }
+    if (message == NULL) {
+        printf("No message found or invalid length.\n");
+        stbi_image_free(img);
+        return;
     }
 
     if (outputFile != NULL) {
@@ -88,13 +548,15 @@ void extractMessagePNG(const char* inputImage, const char* outputFile) {
         if (f) {
             fwrite(message, 1, msgLen, f);
             fclose(f);
-            printf("Successfully extracted content to '%s' (%d bytes).\n", outputFile, msgLen);
+            printf("Successfully extracted content to '%s' (%zu bytes).\n", outputFile, msgLen);
         } else {
             printf("Error: Could not write to file '%s'.\n", outputFile);
         }
     } else {
-        // Auf Konsole ausgeben (nur Text)
-        printf("Extracted content:\n%s\n", message);
+        // Auf Konsole ausgeben (binärsicher, NUL-Bytes inklusive)
+        printf("Extracted content:\n");
+        fwrite(message, 1, msgLen, stdout);
+        printf("\n");
     }
     // ---------------------------------------------
 
@@ -103,6 +565,24 @@ void extractMessagePNG(const char* inputImage, const char* outputFile) {
 }
 
 
+// ------------------------------------------------------------
+// Function: getPngPaletteCapacity
+// Purpose : Bytes that fit into the palette indices of an 8 bit
+//           palette PNG, so the output stays a palette PNG (see
+//           embedIndexed); larger messages make it truecolor
+// Returns : the capacity, -1 if the image isn't a palette PNG
+// ------------------------------------------------------------
+long getPngPaletteCapacity(const char* inputImage) {
+    struct pngReader reader;
+    if (pngOpen(&reader, inputImage) != 0) return -1;
+
+    int indexed = reader.colorType == PNG_PALETTE;
+    size_t pixels = (size_t)reader.width * reader.height;
+    pngClose(&reader);
+    return indexed ? (long)payloadMessageCapacity(pixels) : -1;
+}
+
+// Largest message embed accepts: palette images fall back to truecolor
 long getPngCapacity(const char* inputImage) {
     int width, height, channels;
 
@@ -114,8 +594,60 @@ long getPngCapacity(const char* inputImage) {
     }
 
     // Wir nutzen immer 3 Kanäle (RGB) zum Verstecken, auch wenn Alpha (4) da ist.
-    long maxBits = ((long)width * (long)height * 3) - 32;
+    return (long)payloadMessageCapacity((size_t)width * height * 3);
+}
+
+// ------------------------------------------------------------
+// Function: benchPNG
+// Purpose : Embeds the message once per filter choice (full
+//           heuristic, reuse past the payload, reuse everywhere) and
+//           prints the time and output size of each
+// Method  : Every choice runs `runs` times and the fastest run
+//           counts. The output goes to <input>.bench.png, which is
+//           removed afterwards. *embedTime gets the time of the
+//           default choice (for benchPayload).
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int benchPNG(const char* inputImage, const unsigned char* message, size_t msgLen, int runs, double* embedTime) {
+    static const char* names[] = { "full heuristic", "reuse past payload", "reuse all rows" };
+    char* outputImage = malloc(strlen(inputImage) + sizeof(".bench.png"));
+    if (!outputImage) return -1;
+    sprintf(outputImage, "%s.bench.png", inputImage);
+
+    int saved = pngFilterReuse, result = 0;
+    long long baseSize = 0;
+    double defaultTime = 0;
+    for (int policy = PNG_FILTERS_CHOOSE; policy <= PNG_FILTERS_REUSE && result == 0; policy++) {
+        double best = 0;
+        pngFilterReuse = policy;
+        for (int run = 0; run < runs && result == 0; run++) {
+            double start = timeNow();
+            result = embedPNGStreamed(inputImage, outputImage, message, msgLen, 0);
+            double elapsed = timeNow() - start;
+            if (run == 0 || elapsed < best) best = elapsed;
+        }
+        if (result != 0) break;
+        if (policy == saved) defaultTime = best;
+
+        FILE* f = fopen(outputImage, "rb");
+        long long size = f ? fileSizeOf(f) : -1;
+        if (f) fclose(f);
+        if (policy == PNG_FILTERS_CHOOSE) {
+            printf("%-20s %10s %14s\n", "Filter choice", "Time", "Size");
+            baseSize = size;
+        }
+        printf("%-20s %8.3f s %8lld bytes", names[policy], best, size);
+        if (policy != PNG_FILTERS_CHOOSE && baseSize > 0) printf(" (%+.2f%%)", 100.0 * (size - baseSize) / baseSize);
+        printf("\n");
+    }
+    pngFilterReuse = saved;
+    *embedTime = defaultTime;
+
+    remove(outputImage);
+    free(outputImage);
 
-    if (maxBits < 0) return 0;
-    return maxBits / 8;
+    if (result == 1) printf("Message too long for this image.\n");
+    if (result == -1) printf("The benchmark needs an 8 bit RGB, RGBA or palette PNG without interlacing.\n");
+    if (result == -2) printf("Failed to write output PNG.\n");
+    return result == 0 ? 0 : -1;
 }
@@ -0,0 +1,267 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// LSB kernels
+// A "slot" is one channel byte that carries exactly one payload bit.
+// The payload is a little-endian bit stream: bit k lives in
+// stream[k / 8] at bit position k % 8 (same order the original
+// per-bit loops used, so old images stay readable).
+//
+// Supported pixel layouts:
+//   layout == LSB_RGBA : RGBA, the alpha byte of every pixel is skipped
+//   otherwise     : every byte of the row is a slot (RGB / BGR)
+//
+// The kernels load and store 64 bits at a time, so every stream buffer
+// must be followed by LSB_STREAM_PADDING accessible bytes.
+// ------------------------------------------------------------
+#define LSB_STREAM_PADDING 8
+
+#define LSB_PACKED 0
+#define LSB_RGBA   1
+
+// Returns at least 57 valid stream bits starting at bitPos
+static inline uint64_t lsbLoadBits(const unsigned char *stream, size_t bitPos) {
+    uint64_t word;
+    memcpy(&word, stream + (bitPos >> 3), sizeof(word));
+    return word >> (bitPos & 7);
+}
+
+// Byte offset of a slot inside a row
+static inline size_t lsbSlotOffset(int layout, size_t slot) {
+    return layout == LSB_RGBA ? slot / 3 * 4 + slot % 3 : slot;
+}
+
+// Inserts a zero bit after every 3 bits, so bit groups line up with RGBA pixels
+static inline uint32_t lsbSpreadRgba(uint32_t bits) {
+    return (bits & 0x7) | ((bits & 0x38) << 1) | ((bits & 0x1C0) << 2) | ((bits & 0xE00) << 3)
+        | ((bits & 0x7000) << 4) | ((bits & 0x38000) << 5) | ((bits & 0x1C0000) << 6) | ((bits & 0xE00000) << 7);
+}
+
+// Writes the low n bits of `bits` (n <= 32) into the stream at bitPos,
+// leaving all neighbouring bits untouched
+static inline void lsbStoreBits(unsigned char *stream, size_t bitPos, uint64_t bits, int n) {
+    uint64_t word;
+    uint64_t mask = (((uint64_t)1 << n) - 1) << (bitPos & 7);
+    memcpy(&word, stream + (bitPos >> 3), sizeof(word));
+    word = (word & ~mask) | ((bits << (bitPos & 7)) & mask);
+    memcpy(stream + (bitPos >> 3), &word, sizeof(word));
+}
+
+// Drops every 4th bit (the alpha positions), inverse of lsbSpreadRgba
+static inline uint32_t lsbCompactRgba(uint32_t bits) {
+    return (bits & 0x7) | ((bits >> 1) & 0x38) | ((bits >> 2) & 0x1C0) | ((bits >> 3) & 0xE00)
+        | ((bits >> 4) & 0x7000) | ((bits >> 5) & 0x38000) | ((bits >> 6) & 0x1C0000) | ((bits >> 7) & 0xE00000);
+}
+
+static void lsbEmbedScalar(unsigned char *row, int layout, size_t slot, size_t count,
+                           const unsigned char *stream, size_t bitPos) {
+    for (size_t i = 0; i < count; i++, slot++, bitPos++) {
+        unsigned char *p = row + lsbSlotOffset(layout, slot);
+        *p = (*p & 0xFE) | ((stream[bitPos >> 3] >> (bitPos & 7)) & 1);
+    }
+}
+
+#ifdef CPU_X86
+// Turns 16 bits into 16 bytes holding 0x01 / 0x00
+static inline __m128i lsbExpand16(uint32_t bits) {
+    const __m128i select = _mm_set1_epi64x(0x8040201008040201LL);
+    __m128i v = _mm_cvtsi32_si128((int)bits);
+    v = _mm_unpacklo_epi8(v, v);
+    v = _mm_unpacklo_epi16(v, v);
+    v = _mm_unpacklo_epi32(v, v); // byte 0 eight times, then byte 1 eight times
+    v = _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+    return _mm_and_si128(v, _mm_set1_epi8(1));
+}
+
+static void lsbEmbedSse2(unsigned char *row, int layout, size_t slot, size_t count,
+                         const unsigned char *stream, size_t bitPos) {
+    if (layout == LSB_RGBA) {
+        // Align to a pixel boundary first, then 4 pixels (12 slots) per step
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbEmbedScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        const __m128i keep = _mm_set1_epi32((int)0xFFFEFEFE); // alpha bytes stay untouched
+        for (; count >= 12; slot += 12, bitPos += 12, count -= 12) {
+            unsigned char *p = row + slot / 3 * 4;
+            __m128i bits = lsbExpand16(lsbSpreadRgba((uint32_t)lsbLoadBits(stream, bitPos) & 0xFFF));
+            __m128i px = _mm_loadu_si128((const __m128i *)p);
+            _mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_and_si128(px, keep), bits));
+        }
+    } else {
+        const __m128i keep = _mm_set1_epi8((char)0xFE);
+        for (; count >= 16; slot += 16, bitPos += 16, count -= 16) {
+            unsigned char *p = row + slot;
+            __m128i bits = lsbExpand16((uint32_t)lsbLoadBits(stream, bitPos) & 0xFFFF);
+            __m128i px = _mm_loadu_si128((const __m128i *)p);
+            _mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_and_si128(px, keep), bits));
+        }
+    }
+    lsbEmbedScalar(row, layout, slot, count, stream, bitPos);
+}
+
+// Turns 32 bits into 32 bytes holding 0x01 / 0x00
+__attribute__((target("avx2,bmi2")))
+static inline __m256i lsbExpand32(uint32_t bits) {
+    const __m256i spread = _mm256_setr_epi64x(0, 0x0101010101010101LL, 0x0202020202020202LL, 0x0303030303030303LL);
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), spread);
+    v = _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select);
+    return _mm256_and_si256(v, _mm256_set1_epi8(1));
+}
+
+__attribute__((target("avx2,bmi2")))
+static void lsbEmbedAvx2(unsigned char *row, int layout, size_t slot, size_t count,
+                         const unsigned char *stream, size_t bitPos) {
+    if (layout == LSB_RGBA) {
+        // Align to a pixel boundary first, then 8 pixels (24 slots) per step
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbEmbedScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        const __m256i keep = _mm256_set1_epi32((int)0xFFFEFEFE); // alpha bytes stay untouched
+        for (; count >= 24; slot += 24, bitPos += 24, count -= 24) {
+            unsigned char *p = row + slot / 3 * 4;
+            __m256i bits = lsbExpand32(_pdep_u32((uint32_t)lsbLoadBits(stream, bitPos) & 0xFFFFFF, 0x77777777));
+            __m256i px = _mm256_loadu_si256((const __m256i *)p);
+            _mm256_storeu_si256((__m256i *)p, _mm256_or_si256(_mm256_and_si256(px, keep), bits));
+        }
+    } else {
+        const __m256i keep = _mm256_set1_epi8((char)0xFE);
+        for (; count >= 32; slot += 32, bitPos += 32, count -= 32) {
+            unsigned char *p = row + slot;
+            __m256i bits = lsbExpand32((uint32_t)lsbLoadBits(stream, bitPos));
+            __m256i px = _mm256_loadu_si256((const __m256i *)p);
+            _mm256_storeu_si256((__m256i *)p, _mm256_or_si256(_mm256_and_si256(px, keep), bits));
+        }
+    }
+    lsbEmbedSse2(row, layout, slot, count, stream, bitPos);
+}
+#endif
+
+static void lsbExtractScalar(const unsigned char *row, int layout, size_t slot, size_t count,
+                             unsigned char *stream, size_t bitPos) {
+    for (size_t i = 0; i < count; i++, slot++, bitPos++) {
+        unsigned char bit = row[lsbSlotOffset(layout, slot)] & 1;
+        unsigned char mask = (unsigned char)(1 << (bitPos & 7));
+        stream[bitPos >> 3] = bit ? (stream[bitPos >> 3] | mask) : (stream[bitPos >> 3] & ~mask);
+    }
+}
+
+#ifdef CPU_X86
+static void lsbExtractSse2(const unsigned char *row, int layout, size_t slot, size_t count,
+                           unsigned char *stream, size_t bitPos) {
+    if (layout == LSB_RGBA) {
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbExtractScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        for (; count >= 12; slot += 12, bitPos += 12, count -= 12) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(row + slot / 3 * 4));
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_slli_epi16(px, 7));
+            lsbStoreBits(stream, bitPos, lsbCompactRgba(bits), 12);
+        }
+    } else {
+        for (; count >= 16; slot += 16, bitPos += 16, count -= 16) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(row + slot));
+            lsbStoreBits(stream, bitPos, (uint32_t)_mm_movemask_epi8(_mm_slli_epi16(px, 7)), 16);
+        }
+    }
+    lsbExtractScalar(row, layout, slot, count, stream, bitPos);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void lsbExtractAvx2(const unsigned char *row, int layout, size_t slot, size_t count,
+                           unsigned char *stream, size_t bitPos) {
+    if (layout == LSB_RGBA) {
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbExtractScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        for (; count >= 24; slot += 24, bitPos += 24, count -= 24) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(row + slot / 3 * 4));
+            uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(px, 7));
+            lsbStoreBits(stream, bitPos, _pext_u32(bits, 0x77777777), 24);
+        }
+    } else {
+        for (; count >= 32; slot += 32, bitPos += 32, count -= 32) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(row + slot));
+            lsbStoreBits(stream, bitPos, (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(px, 7)), 32);
+        }
+    }
+    lsbExtractSse2(row, layout, slot, count, stream, bitPos);
+}
+#endif
+
+#ifdef CPU_X86
+__attribute__((target("avx512bw,bmi2")))
+static void lsbEmbedAvx512(unsigned char *row, int layout, size_t slot, size_t count,
+                           const unsigned char *stream, size_t bitPos) {
+    const __m512i one = _mm512_set1_epi8(1);
+
+    if (layout == LSB_RGBA) {
+        // Align to a pixel boundary first, then 16 pixels (48 slots) per step
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbEmbedScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        const __m512i keep = _mm512_set1_epi32((int)0xFFFEFEFE); // alpha bytes stay untouched
+        for (; count >= 48; slot += 48, bitPos += 48, count -= 48) {
+            unsigned char *p = row + slot / 3 * 4;
+            __mmask64 bits = _pdep_u64(lsbLoadBits(stream, bitPos) & 0xFFFFFFFFFFFFULL, 0x7777777777777777ULL);
+            __m512i px = _mm512_and_si512(_mm512_loadu_si512(p), keep);
+            _mm512_storeu_si512(p, _mm512_mask_mov_epi8(px, bits, _mm512_or_si512(px, one)));
+        }
+    } else {
+        const __m512i keep = _mm512_set1_epi8((char)0xFE);
+        for (; count >= 64; slot += 64, bitPos += 64, count -= 64) {
+            unsigned char *p = row + slot;
+            __mmask64 bits = (lsbLoadBits(stream, bitPos) & 0xFFFFFFFF) | (lsbLoadBits(stream, bitPos + 32) << 32);
+            __m512i px = _mm512_and_si512(_mm512_loadu_si512(p), keep);
+            _mm512_storeu_si512(p, _mm512_mask_mov_epi8(px, bits, _mm512_or_si512(px, one)));
+        }
+    }
+    lsbEmbedAvx2(row, layout, slot, count, stream, bitPos);
+}
+
+__attribute__((target("avx512bw,bmi2")))
+static void lsbExtractAvx512(const unsigned char *row, int layout, size_t slot, size_t count,
+                             unsigned char *stream, size_t bitPos) {
+    const __m512i one = _mm512_set1_epi8(1);
+
+    if (layout == LSB_RGBA) {
+        size_t head = (3 - slot % 3) % 3;
+        if (head > count) head = count;
+        lsbExtractScalar(row, layout, slot, head, stream, bitPos);
+        slot += head; bitPos += head; count -= head;
+
+        for (; count >= 48; slot += 48, bitPos += 48, count -= 48) {
+            __m512i px = _mm512_loadu_si512(row + slot / 3 * 4);
+            uint64_t bits = _pext_u64(_mm512_test_epi8_mask(px, one), 0x7777777777777777ULL);
+            lsbStoreBits(stream, bitPos, bits, 32);
+            lsbStoreBits(stream, bitPos + 32, bits >> 32, 16);
+        }
+    } else {
+        for (; count >= 64; slot += 64, bitPos += 64, count -= 64) {
+            uint64_t bits = _mm512_test_epi8_mask(_mm512_loadu_si512(row + slot), one);
+            lsbStoreBits(stream, bitPos, bits, 32);
+            lsbStoreBits(stream, bitPos + 32, bits >> 32, 32);
+        }
+    }
+    lsbExtractAvx2(row, layout, slot, count, stream, bitPos);
+}
+#endif
+
+// Per-ISA entry points, selected once at startup (see dispatch.c)
+typedef void (*lsbEmbedFn)(unsigned char *row, int layout, size_t slot, size_t count,
+                           const unsigned char *stream, size_t bitPos);
+typedef void (*lsbExtractFn)(const unsigned char *row, int layout, size_t slot, size_t count,
+                             unsigned char *stream, size_t bitPos);
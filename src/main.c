@@ -1,9 +1,25 @@
+#define _GNU_SOURCE // asprintf, copy_file_range
 #include <stdio.h>
 #include <strings.h> // Wichtig für strcasecmp auf Mac/Linux
 
 // link other c files
 #include "cli.c"
+#include "cpu.c"
+#include "lsb.c"
+#include "png-filter.c"
+#include "aes-gcm.c"
+#include "reed-solomon.c"
+#include "crc32c.c"
+#include "dispatch.c"
+#include "threads.c"
+#include "zlib.c"
+#include "engine.c"
+#include "fileio.c"
 #include "image-bmp.c"
+#include "png-reader.c"
+#include "png-writer.c"
+#include "png-preset.c"
+#include "png-carrier.c"
 #include "image-png.c"
 
 // Kleine Hilfsfunktion, um die Dateiendung zu finden
@@ -19,27 +35,27 @@ int isPng(const char *filename) {
     return (strcasecmp(ext, "png") == 0);
 }
 
-// Hilfsfunktion: Versucht eine Textdatei zu lesen
+// Hilfsfunktion: Versucht eine Datei zu lesen (binärsicher, Länge in *length)
 // Gibt NULL zurück, wenn die Datei nicht existiert.
-char* readFileContent(const char* filename) {
+unsigned char* readFileContent(const char* filename, size_t* length) {
     FILE* f = fopen(filename, "rb");
     if (!f) {
         return NULL; // Datei existiert nicht -> Es ist wohl ein normaler Text-String
     }
 
     fseek(f, 0, SEEK_END);
-    long length = ftell(f);
+    long size = ftell(f);
     rewind(f);
 
-    // Speicher reservieren (+1 für das Null-Byte am Ende)
-    char* buffer = malloc(length + 1);
+    // Speicher reservieren (+1, damit auch leere Dateien einen Puffer bekommen)
+    unsigned char* buffer = size >= 0 ? malloc((size_t)size + 1) : NULL;
     if (!buffer) {
         fclose(f);
         return NULL;
     }
 
-    fread(buffer, 1, length, f);
-    buffer[length] = '\0'; // String abschließen
+    // Die Länge zählt, nicht das erste Null-Byte
+    *length = fread(buffer, 1, (size_t)size, f);
     fclose(f);
 
     return buffer;
@@ -49,37 +65,91 @@ static int runEmbed(struct command *cmd) {
     char *inputFile = getArgument(cmd, "file");
     char *rawContentArg = getArgument(cmd, "content");
 
-    char *messageToEmbed = NULL;
+    unsigned char *messageToEmbed = NULL;
+    size_t messageLength = 0;
     int mustFreeMessage = 0; // Merker, ob wir den Speicher später freigeben müssen
 
     // 1. Versuch: Ist das Argument ein Dateipfad?
-    char *fileContent = readFileContent(rawContentArg);
+    unsigned char *fileContent = readFileContent(rawContentArg, &messageLength);
 
     if (fileContent != NULL) {
         // Ja, Datei gefunden! Inhalt nutzen.
         messageToEmbed = fileContent;
         mustFreeMessage = 1; // Wir haben malloc in readFileContent genutzt
-        printf("Reading content from file: '%s' (%lu bytes)\n", rawContentArg, strlen(messageToEmbed));
+        printf("Reading content from file: '%s' (%zu bytes)\n", rawContentArg, messageLength);
     } else {
         // Nein, Datei nicht gefunden. Wir nutzen das Argument direkt als Text.
-        messageToEmbed = rawContentArg;
+        messageToEmbed = (unsigned char *)rawContentArg;
+        messageLength = strlen(rawContentArg);
         mustFreeMessage = 0; // Das ist nur ein Pointer auf argv, nicht freigeben!
         printf("Embedding raw text string.\n");
     }
 
-    // 2. Output Dateiname bestimmen
+    // 2. Output Dateiname und Optionen bestimmen
     char *outputFile = getOption(cmd, "output");
+    char *threads = getOption(cmd, "threads");
+    char *pngPreset = getOption(cmd, "png-preset");
+    char *carrier = getOption(cmd, "carrier");
+    bool inPlace = getOptionFlag(cmd, "in-place");
+    bool patchCopy = getOptionFlag(cmd, "patch-copy");
+    bool compress = getOptionFlag(cmd, "compress");
+    char *key = getOption(cmd, "key");
+    char *fec = getOption(cmd, "fec");
+    bool valid = false;
+
+    if (threads != NULL && threadsSet(threads) != 0) {
+        // Fehlermeldung kommt von threadsSet
+    } else if (key != NULL && payloadKeySet(key) != 0) {
+        // Fehlermeldung kommt von payloadKeySet
+    } else if (fec != NULL && payloadFecSet(fec) != 0) {
+        // Fehlermeldung kommt von payloadFecSet
+    } else if (pngPreset != NULL && !isPng(inputFile)) {
+        printf("--png-preset only applies to PNG files.\n");
+    } else if (carrier != NULL && strcmp(carrier, "lsb") != 0 && strcmp(carrier, "chunk") != 0) {
+        printf("Invalid carrier \"%s\" (use lsb or chunk).\n", carrier);
+    } else if (carrier != NULL && strcmp(carrier, "chunk") == 0 && !isPng(inputFile)) {
+        printf("--carrier chunk only applies to PNG files.\n");
+    } else if (pngPreset != NULL && pngPresetSet(pngPreset) != 0) {
+        // Fehlermeldung kommt von pngPresetSet (nach --threads, auto misst mit dieser Anzahl)
+    } else if ((inPlace || patchCopy) && isPng(inputFile)) {
+        printf("--in-place and --patch-copy are only supported for BMP files.\n");
+    } else if (inPlace && (patchCopy || outputFile != NULL)) {
+        printf("--in-place modifies the input file, it can't be combined with --output or --patch-copy.\n");
+    } else {
+        valid = true;
+    }
 
-    // Automatisch entscheiden: Ist der Input ein PNG?
-    if (isPng(inputFile)) {
+    // 3. Optional komprimieren (nach --threads: das Deflate läuft auf den Worker-Threads)
+    if (valid && compress) {
+        unsigned char *packed = payloadCompress(messageToEmbed, &messageLength);
+        if (packed != NULL) {
+            if (mustFreeMessage) free(messageToEmbed);
+            messageToEmbed = packed;
+            mustFreeMessage = 1;
+        }
+    }
+
+    if (!valid) {
+        // Fehlermeldung wurde oben ausgegeben
+    } else if (inPlace) {
+        // Nur die betroffenen Bytes der Datei selbst überschreiben
+        embedMessageInPlace(inputFile, messageToEmbed, messageLength);
+    } else if (patchCopy) {
+        if (outputFile == NULL) outputFile = "out.bmp";
+        embedMessagePatchCopy(inputFile, outputFile, messageToEmbed, messageLength);
+    } else if (carrier != NULL && strcmp(carrier, "chunk") == 0) {
+        // Nachricht als eigener Chunk, die Pixel bleiben unangetastet
+        if (outputFile == NULL) outputFile = "out.png";
+        embedMessageChunkPNG(inputFile, outputFile, messageToEmbed, messageLength);
+    } else if (isPng(inputFile)) {
         if (outputFile == NULL) outputFile = "out.png";
-        embedMessagePNG(inputFile, outputFile, messageToEmbed);
+        embedMessagePNG(inputFile, outputFile, messageToEmbed, messageLength);
     } else {
         if (outputFile == NULL) outputFile = "out.bmp";
-        embedMessage(inputFile, outputFile, messageToEmbed);
+        embedMessage(inputFile, outputFile, messageToEmbed, messageLength);
     }
 
-    // 3. Wichtig: Speicher aufräumen, falls wir eine Datei gelesen haben
+    // 4. Wichtig: Speicher aufräumen, falls wir eine Datei gelesen haben
     if (mustFreeMessage) {
         free(messageToEmbed);
     }
@@ -95,7 +165,7 @@ void initEmbedCmd(struct command *parent, struct command *cmd) {
         },
         {
             .name = "content",
-            .description = "Text to be hidden inside the image",
+            .description = "Text or file (any binary content) to be hidden inside the image",
         },
     };
 
@@ -105,6 +175,48 @@ void initEmbedCmd(struct command *parent, struct command *cmd) {
             .shorthand = 'o',
             .description = "Output filename",
         },
+        {
+            .name = "in-place",
+            .description = "Modify the input BMP itself, only the bytes holding the message are rewritten",
+            .flag = true,
+        },
+        {
+            .name = "patch-copy",
+            .description = "Copy the input BMP to the output and rewrite only the bytes holding the message",
+            .flag = true,
+        },
+        {
+            .name = "threads",
+            .shorthand = 't',
+            .description = "Number of threads for large images (default 1, \"auto\" = one per CPU)",
+        },
+        {
+            .name = "png-preset",
+            .description = "PNG speed/size trade-off: fastest, balanced (default), smallest, "
+                "or auto[:ms] = the smallest one that encodes a megapixel within ms milliseconds on this machine",
+        },
+        {
+            .name = "carrier",
+            .description = "Where the content goes in a PNG: lsb (default, the pixels) or chunk "
+                "(a private chunk: no size limit and no decoding, but visible to anyone listing the chunks)",
+        },
+        {
+            .name = "compress",
+            .shorthand = 'z',
+            .description = "Compress the content first (skipped for content that is compressed already); "
+                "extract decompresses it automatically",
+            .flag = true,
+        },
+        {
+            .name = "key",
+            .shorthand = 'k',
+            .description = "Encrypt the content with AES-256-GCM: 64 hex digits, or a file holding 32 bytes or 64 hex digits",
+        },
+        {
+            .name = "fec",
+            .description = "Add Reed-Solomon error correction with the given redundancy in percent (1-100), "
+                "so extract can repair damaged bits (e.g. 10 repairs up to 12 damaged bytes per codeword)",
+        },
     };
 
     *cmd = (struct command){
@@ -115,23 +227,32 @@ void initEmbedCmd(struct command *parent, struct command *cmd) {
         .arguments = arguments,
         .argumentCount = 2,
         .options = options,
-        .optionCount = 1,
+        .optionCount = 9,
         .run = runEmbed,
     };
 
     char *fullName = fullCommandPath(cmd);
-    char **examples = malloc(5 * sizeof(char *));
+    char **examples = malloc(14 * sizeof(char *));
 
     asprintf(&examples[0], "%s sample.png \"My hidden message\"", fullName);
     asprintf(&examples[1], "%s sample.bmp \"My hidden message\"", fullName);
     asprintf(&examples[2], "%s sample.png topSecret.txt", fullName);
     asprintf(&examples[3], "%s sample.png \"Example text\" --output output.png", fullName);
     asprintf(&examples[4], "%s sample.bmp \"Example text\" -o output.bmp", fullName);
+    asprintf(&examples[5], "%s sample.bmp \"Example text\" --in-place", fullName);
+    asprintf(&examples[6], "%s sample.bmp \"Example text\" --patch-copy -o output.bmp", fullName);
+    asprintf(&examples[7], "%s huge.bmp archive.zip --threads auto -o output.bmp", fullName);
+    asprintf(&examples[8], "%s sample.png topSecret.txt --png-preset smallest", fullName);
+    asprintf(&examples[9], "%s huge.png archive.zip --png-preset auto:200 --threads auto", fullName);
+    asprintf(&examples[10], "%s huge.png archive.zip --carrier chunk", fullName);
+    asprintf(&examples[11], "%s sample.png topSecret.txt --compress", fullName);
+    asprintf(&examples[12], "%s sample.png topSecret.txt --compress --key secret.key", fullName);
+    asprintf(&examples[13], "%s sample.png topSecret.txt --fec 10", fullName);
 
     free(fullName);
 
     cmd->examples = examples;
-    cmd->exampleCount = 5;
+    cmd->exampleCount = 14;
 }
 
 static int runExtract(struct command *cmd) {
@@ -139,6 +260,16 @@ static int runExtract(struct command *cmd) {
 
     //Output Option abrufen
     char *outputFile = getOption(cmd, "output");
+    char *threads = getOption(cmd, "threads");
+    char *key = getOption(cmd, "key");
+    if (threads != NULL && threadsSet(threads) != 0) {
+        return 0;
+    }
+    if (key != NULL && payloadKeySet(key) != 0) {
+        return 0;
+    }
+    // Nur Inhalte mit Prüfsumme akzeptieren (Bilder ohne Inhalt scheitern nach 32 Bits)
+    payloadStrict = getOptionFlag(cmd, "strict");
 
     if (isPng(inputFile)) {
         extractMessagePNG(inputFile, outputFile);
@@ -161,8 +292,24 @@ void initExtractCmd(struct command *parent, struct command *cmd) {
         {
             .name = "output",
             .shorthand = 'o',
-            .description = "Output filename (should be .txt)",
-        }
+            .description = "Output filename for the extracted content",
+        },
+        {
+            .name = "threads",
+            .shorthand = 't',
+            .description = "Number of threads for large messages (default 1, \"auto\" = one per CPU)",
+        },
+        {
+            .name = "key",
+            .shorthand = 'k',
+            .description = "Key the content was encrypted with (64 hex digits or a key file, see embed --key)",
+        },
+        {
+            .name = "strict",
+            .description = "Only accept content with a checksummed header (rejects images without content after "
+                "the first 32 bits, but also content embedded by older versions)",
+            .flag = true,
+        },
     };
 
     *cmd = (struct command){
@@ -173,31 +320,35 @@ void initExtractCmd(struct command *parent, struct command *cmd) {
         .arguments = arguments,
         .argumentCount = 1,
         .options = options,
-        .optionCount = 1,
+        .optionCount = 4,
         .run = runExtract,
     };
 
     char *fullName = fullCommandPath(cmd);
-    char **examples = malloc(4 * sizeof(char *));
+    char **examples = malloc(7 * sizeof(char *));
 
     asprintf(&examples[0], "%s out.png", fullName);
     asprintf(&examples[1], "%s out.bmp", fullName);
     asprintf(&examples[2], "%s out.png -o exfiltratedData.txt", fullName);
     asprintf(&examples[3], "%s out.png --output exfiltratedData.txt", fullName);
+    asprintf(&examples[4], "%s output.bmp -o archive.zip --threads auto", fullName);
+    asprintf(&examples[5], "%s out.png -o topSecret.txt --key secret.key", fullName);
+    asprintf(&examples[6], "%s scanned.png --strict", fullName);
 
     free(fullName);
 
     cmd->examples = examples;
-    cmd->exampleCount = 4;
+    cmd->exampleCount = 7;
 }
 
 static int runCapacity(struct command *cmd) {
     char *inputFile = getArgument(cmd, "file");
-    long capacity = 0;
+    long capacity = 0, paletteCapacity = -1;
 
-    // 1. Kapazität ermitteln
+    // 1. Kapazität ermitteln (Palettenbilder: bis wohin sie Palettenbilder bleiben)
     if (isPng(inputFile)) {
         capacity = getPngCapacity(inputFile);
+        paletteCapacity = getPngPaletteCapacity(inputFile);
     } else {
         capacity = getBmpCapacity(inputFile);
     }
@@ -232,6 +383,10 @@ static int runCapacity(struct command *cmd) {
     } else {
         printf("Max. hidden data   : %.2f KB (%ld bytes)\n", (double)capacity / 1024, capacity);
     }
+    if (paletteCapacity >= 0 && paletteCapacity < capacity) {
+        printf("Palette-preserving : %.2f KB (%ld bytes), more is written as a truecolor PNG\n",
+               (double)paletteCapacity / 1024, paletteCapacity);
+    }
 
     printf("\nEstimated Text Content:\n");
 
@@ -281,7 +436,108 @@ void initCapacityCmd(struct command *parent, struct command *cmd) {
     };
 }
 
+static int runBench(struct command *cmd) {
+    char *inputFile = getArgument(cmd, "file");
+    char *rawContentArg = getArgument(cmd, "content");
+    char *threads = getOption(cmd, "threads");
+    int runs = getOption(cmd, "runs") != NULL ? getOptionInt(cmd, "runs") : 3;
+
+    if (threads != NULL && threadsSet(threads) != 0) {
+        return 1;
+    }
+    if (runs < 1) {
+        printf("Invalid number of runs (use 1 or more).\n");
+        return 1;
+    }
+    if (!isPng(inputFile)) {
+        printf("The benchmark compares PNG filter choices, it needs a .png file.\n");
+        return 1;
+    }
+
+    // Inhalt wie bei embed: Datei, falls es sie gibt, sonst der Text selbst
+    size_t messageLength = 0;
+    unsigned char *fileContent = readFileContent(rawContentArg, &messageLength);
+    unsigned char *message = fileContent != NULL ? fileContent : (unsigned char *)rawContentArg;
+    if (fileContent == NULL) messageLength = strlen(rawContentArg);
+
+    // Erst die Filterwahl beim Einbetten, dann die Nutzlast-Stufen im Verhältnis dazu
+    double embedTime = 0;
+    int result = benchPNG(inputFile, message, messageLength, runs, &embedTime);
+    if (result == 0) result = benchPayload(message, messageLength, runs, embedTime);
+    free(fileContent);
+    return result == 0 ? 0 : 1;
+}
+
+void initBenchCmd(struct command *parent, struct command *cmd) {
+    static struct argument arguments[] = {
+        {
+            .name = "file",
+            .description = "Input PNG filename",
+        },
+        {
+            .name = "content",
+            .description = "Text or file to embed for the measurement",
+        },
+    };
+
+    static struct option options[] = {
+        {
+            .name = "runs",
+            .shorthand = 'r',
+            .description = "Runs per variant, the fastest one counts (default 3)",
+        },
+        {
+            .name = "threads",
+            .shorthand = 't',
+            .description = "Number of threads for large images (default 1, \"auto\" = one per CPU)",
+        },
+    };
+
+    *cmd = (struct command){
+        .name = "bench",
+        .description = "The bench command embeds the content into a PNG once with every filter choice "
+            "(full heuristic, filters of the input reused past the payload, reused everywhere) "
+            "and compares time and output size, then measures what AES-256-GCM encryption (--key), "
+            "Reed-Solomon parity (--fec) and the CRC32C checksum add to it. No output file is kept.",
+        .shortDescription = "Compares the PNG filter choices and measures --key, --fec and the checksum",
+        .parent = parent,
+        .arguments = arguments,
+        .argumentCount = 2,
+        .options = options,
+        .optionCount = 2,
+        .run = runBench,
+    };
+
+    char *fullName = fullCommandPath(cmd);
+    char **examples = malloc(2 * sizeof(char *));
+
+    asprintf(&examples[0], "%s sample.png topSecret.txt", fullName);
+    asprintf(&examples[1], "%s huge.png archive.zip --runs 5 --threads auto", fullName);
+
+    free(fullName);
+
+    cmd->examples = examples;
+    cmd->exampleCount = 2;
+}
+
+// Globale Optionen anwenden, bevor ein Befehl ausgeführt wird
+static int applyRootOptions(struct command *cmd) {
+    char *forceIsa = getOption(cmd, "force-isa");
+    if (forceIsa == NULL) {
+        return 0;
+    }
+
+    return initKernels(forceIsa) == 0 ? 0 : 1;
+}
+
 void initRootCmd(struct command *cmd) {
+    static struct option options[] = {
+        {
+            .name = "force-isa",
+            .description = "Use the scalar, sse2, avx2 or avx512bw kernels instead of the best one for this CPU",
+        },
+    };
+
     *cmd = (struct command){
         .name = "stego",
         .description = "stego CLI v1.1.0 - Supports PNG and BMP\n\n"
@@ -290,18 +546,25 @@ void initRootCmd(struct command *cmd) {
             "Anujan Sivakurunathan\n"
             "Kevin Krummenacher\n"
             "Tamino Walter",
+        .options = options,
+        .optionCount = 1,
+        .persistentPreRun = applyRootOptions,
     };
 
-    static struct command subCommands[3];
+    static struct command subCommands[4];
     initEmbedCmd(cmd, &subCommands[0]);
     initExtractCmd(cmd, &subCommands[1]);
     initCapacityCmd(cmd, &subCommands[2]);
+    initBenchCmd(cmd, &subCommands[3]);
 
     cmd->subcommands = subCommands;
-    cmd->subcommandCount = 3;
+    cmd->subcommandCount = 4;
 }
 
 int main(int argc, char **argv) {
+    // CPU einmalig prüfen und die passenden Kernels wählen
+    initKernels(NULL);
+
     struct command root;
     initRootCmd(&root);
 
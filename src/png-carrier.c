@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// Chunk carrier (embed --carrier chunk)
+// The message goes into private ancillary chunks ("stEg":
+// ancillary, private, safe to copy) in front of IEND instead of
+// into the pixels. Everything else is copied as it is, without
+// inflating a byte, so embedding and extracting run at disk speed
+// and the message size doesn't depend on the image. The price: the
+// chunk is plain to see for anyone who lists the chunks.
+//
+// Chunk data: the payload header (payloadPutHeader), then the
+// message, split over as many chunks as needed. Old stEg chunks are
+// dropped. Since the new ones come after the image data, the file
+// offsets in a stIX index stay valid.
+// ------------------------------------------------------------
+#define PNG_CARRIER_TYPE "stEg"
+#define PNG_CARRIER_CHUNK (1 << 24) // data bytes per chunk
+
+struct carrierChunk {
+    long long offset; // of the chunk header
+    uint32_t length;
+};
+
+// Reads the chunk header at `offset`; returns 0 on success
+static int carrierChunkAt(FILE *f, long long offset, uint32_t *length, char type[5]) {
+    unsigned char header[8];
+    if (fileReadAt(f, offset, header, 8) != 0) return -1;
+
+    *length = pngGetU32(header);
+    memcpy(type, header + 4, 4);
+    type[4] = '\0';
+    return *length > 0x7FFFFFFF ? -1 : 0;
+}
+
+// ------------------------------------------------------------
+// Function: embedMessageChunkPNG
+// Purpose : Copies the PNG chunk by chunk and puts the message into
+//           stEg chunks in front of IEND
+// Method  : Runs of chunks that are kept are copied in one go
+//           (fileCopyRange). The output is written under a temporary
+//           name and renamed, so it may replace the input.
+// ------------------------------------------------------------
+void embedMessageChunkPNG(const char *inputImage, const char *outputImage, const unsigned char *message,
+                          size_t msgLen) {
+    FILE *in = fopen(inputImage, "rb");
+    long long size = in ? fileSizeOf(in) : -1;
+    unsigned char signature[8];
+    uint32_t length;
+    char type[5];
+
+    if (!in || size < 8 || fileReadAt(in, 0, signature, 8) != 0 || memcmp(signature, pngSignature, 8) != 0 ||
+        carrierChunkAt(in, 8, &length, type) != 0 || strcmp(type, "IHDR") != 0) {
+        printf("Error loading PNG: %s\n", inputImage);
+        if (in) fclose(in);
+        return;
+    }
+
+    char *temporary = malloc(strlen(outputImage) + 5);
+    unsigned char *stream = payloadStream(message, msgLen);
+    FILE *out = NULL;
+    if (temporary) {
+        sprintf(temporary, "%s.tmp", outputImage);
+        out = fopen(temporary, "wb");
+    }
+
+    int result = out && stream ? 0 : -1;
+    long long position = 8, kept = 0; // chunks from `kept` up to `position` still have to be copied
+    int done = 0;
+    pngCrcInit();
+    while (result == 0 && !done) {
+        if (position + 12 > size || carrierChunkAt(in, position, &length, type) != 0 ||
+            position + 12 + length > size) {
+            result = -1; // no IEND
+            break;
+        }
+
+        if (strcmp(type, PNG_CARRIER_TYPE) == 0 || strcmp(type, "IEND") == 0) {
+            result = fileCopyRange(in, kept, position - kept, out);
+            kept = position + 12 + length;
+        }
+        if (strcmp(type, "IEND") == 0) {
+            size_t total = PAYLOAD_HEADER_BYTES + payloadStoredLength(msgLen);
+            for (size_t at = 0; at < total && result == 0; at += PNG_CARRIER_CHUNK) {
+                size_t n = total - at < PNG_CARRIER_CHUNK ? total - at : PNG_CARRIER_CHUNK;
+                result = pngWriteChunk(out, PNG_CARRIER_TYPE, stream + at, n,
+                                       pngChunkCrc(PNG_CARRIER_TYPE, stream + at, n));
+            }
+            if (result == 0) result = pngWriteChunk(out, "IEND", NULL, 0, pngChunkCrc("IEND", NULL, 0));
+            done = 1;
+        }
+        position += 12 + (long long)length;
+    }
+    fclose(in);
+
+    if (out && fclose(out) != 0) result = -1;
+#ifdef _WIN32
+    if (result == 0) remove(outputImage); // rename doesn't replace files there
+#endif
+    if (result != 0 || rename(temporary, outputImage) != 0) {
+        if (out) remove(temporary);
+        printf("Failed to write output PNG.\n");
+    } else {
+        printf("Embedded successfully (%s chunk). Created file %s\n", PNG_CARRIER_TYPE, outputImage);
+    }
+    free(temporary);
+    free(stream);
+}
+
+// ------------------------------------------------------------
+// Function: extractChunkPNG
+// Purpose : Looks for stEg chunks, skipping from chunk header to
+//           chunk header, and reads the message out of them
+// Returns : 1 = found (*message malloc'ed), 0 = no stEg chunk,
+//           -1 = the chunks don't hold a valid payload (the reason
+//           has been printed)
+// ------------------------------------------------------------
+int extractChunkPNG(const char *inputImage, unsigned char **message, size_t *msgLen) {
+    FILE *f = fopen(inputImage, "rb");
+    long long size = f ? fileSizeOf(f) : -1;
+    struct carrierChunk *chunks = NULL;
+    int count = 0, capacity = 0;
+    uint64_t total = 0;
+    uint32_t length;
+    char type[5];
+
+    *message = NULL;
+    *msgLen = 0;
+    if (!f) return 0;
+
+    for (long long position = 8; position + 12 <= size; position += 12 + (long long)length) {
+        if (carrierChunkAt(f, position, &length, type) != 0 || strcmp(type, "IEND") == 0) break;
+        if (strcmp(type, PNG_CARRIER_TYPE) != 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 4;
+            struct carrierChunk *grown = realloc(chunks, capacity * sizeof(*chunks));
+            if (!grown) break;
+            chunks = grown;
+        }
+        chunks[count++] = (struct carrierChunk){ position, length };
+        total += length;
+    }
+    if (count == 0) {
+        fclose(f);
+        free(chunks);
+        return 0;
+    }
+
+    // Header first (it may in theory be split over chunks; its first 4
+    // bytes tell its size), then the message
+    unsigned char header[PAYLOAD_HEADER_BYTES];
+    struct payloadHeader h;
+    uint64_t at = 0, headerBytes = PAYLOAD_LEGACY_BITS / 8;
+    int result = 1;
+    for (int c = 0; c < count && result == 1; c++) {
+        long long offset = chunks[c].offset + 8;
+        uint64_t left = chunks[c].length;
+        while (left > 0 && result == 1) {
+            if (at < headerBytes) {
+                size_t n = left < headerBytes - at ? (size_t)left : (size_t)(headerBytes - at);
+                if (fileReadAt(f, offset, header + at, n) != 0) result = -1;
+                at += n;
+                offset += (long long)n;
+                left -= n;
+                if (result == 1 && at == PAYLOAD_LEGACY_BITS / 8) {
+                    headerBytes = payloadHeaderBits(header) / 8;
+                    if (headerBytes == PAYLOAD_LEGACY_BITS / 8) result = -1; // the carrier never wrote those
+                }
+                if (result == 1 && at == headerBytes &&
+                    (payloadParseHeader(header, (size_t)total * 8, &h) != 0 || h.length != total - headerBytes ||
+                     !(*message = streamAlloc((size_t)h.length + 1)))) {
+                    result = -1;
+                }
+            } else {
+                if (fileReadAt(f, offset, *message + (at - headerBytes), (size_t)left) != 0) result = -1;
+                at += left;
+                left = 0;
+            }
+        }
+    }
+    fclose(f);
+    free(chunks);
+
+    if (result == 1 && *message) {
+        *msgLen = (size_t)h.length;
+        return payloadUnpack(h.flags, message, msgLen) == 0 ? 1 : -1;
+    }
+    printf("The %s chunk doesn't hold a valid payload.\n", PNG_CARRIER_TYPE);
+    free(*message);
+    *message = NULL;
+    return -1;
+}
@@ -0,0 +1,264 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// PNG row filters
+// Shared by the PNG reader (unfilter) and writer (filter + the
+// score used to pick a filter per row). The unfilter and score
+// kernels exist per ISA and are called through the dispatch table.
+// ------------------------------------------------------------
+enum { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+
+static inline unsigned char pngPaeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+}
+
+// Filters one row with the given type (prior = previous row, zeros for the first)
+static void pngFilterRow(unsigned char *out, const unsigned char *row, const unsigned char *prior,
+                         size_t length, int bpp, int filter) {
+    size_t i;
+
+    switch (filter) {
+    case PNG_FILTER_NONE:
+        memcpy(out, row, length);
+        break;
+    case PNG_FILTER_SUB:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = row[i];
+        for (; i < length; i++) out[i] = row[i] - row[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for (i = 0; i < length; i++) out[i] = row[i] - prior[i];
+        break;
+    case PNG_FILTER_AVG:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = row[i] - (prior[i] >> 1);
+        for (; i < length; i++) out[i] = row[i] - ((row[i - bpp] + prior[i]) >> 1);
+        break;
+    case PNG_FILTER_PAETH:
+        for (i = 0; i < (size_t)bpp; i++) out[i] = row[i] - prior[i];
+        for (; i < length; i++) out[i] = row[i] - pngPaeth(row[i - bpp], prior[i], prior[i - bpp]);
+        break;
+    }
+}
+
+// Reverses the row filter in place (prior = unfiltered previous row);
+// returns -1 for an unknown filter type
+typedef int (*pngUnfilterFn)(unsigned char *row, const unsigned char *prior, size_t length, int bpp, int filter);
+
+static int pngUnfilterScalar(unsigned char *row, const unsigned char *prior, size_t length, int bpp, int filter) {
+    size_t i;
+
+    switch (filter) {
+    case PNG_FILTER_NONE:
+        break;
+    case PNG_FILTER_SUB:
+        for (i = bpp; i < length; i++) row[i] += row[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for (i = 0; i < length; i++) row[i] += prior[i];
+        break;
+    case PNG_FILTER_AVG:
+        for (i = 0; i < (size_t)bpp; i++) row[i] += prior[i] >> 1;
+        for (; i < length; i++) row[i] += (row[i - bpp] + prior[i]) >> 1;
+        break;
+    case PNG_FILTER_PAETH:
+        for (i = 0; i < (size_t)bpp; i++) row[i] += prior[i];
+        for (; i < length; i++) row[i] += pngPaeth(row[i - bpp], prior[i], prior[i - bpp]);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef CPU_X86
+// ------------------------------------------------------------
+// SIMD unfilter
+// Sub, Average and Paeth depend on the pixel to the left, so they
+// go one pixel (3 or 4 bytes) per step, but all bytes of a pixel at
+// once and without branches; Paeth works on 16 bit lanes (same
+// scheme as libpng's SSE2 filters). Up has no such dependency and
+// takes whole vectors. Other pixel sizes (palette rows) stay scalar.
+// ------------------------------------------------------------
+// 3 byte pixels are moved as 16 + 8 bits; a 3 byte memcpy goes through the stack
+static inline __m128i pngLoadPixel(const unsigned char *p, int bpp) {
+    uint32_t v;
+    if (bpp == 4) {
+        memcpy(&v, p, 4);
+    } else {
+        uint16_t low;
+        memcpy(&low, p, 2);
+        v = low | ((uint32_t)p[2] << 16);
+    }
+    return _mm_cvtsi32_si128((int)v);
+}
+
+static inline void pngStorePixel(unsigned char *p, __m128i v, int bpp) {
+    uint32_t x = (uint32_t)_mm_cvtsi128_si32(v);
+    if (bpp == 4) {
+        memcpy(p, &x, 4);
+    } else {
+        uint16_t low = (uint16_t)x;
+        memcpy(p, &low, 2);
+        p[2] = (unsigned char)(x >> 16);
+    }
+}
+
+static inline __m128i pngSelect(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i pngAbs16(__m128i v) {
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// bpp is a constant at every call site, so the pixel loads become plain moves
+static inline __attribute__((always_inline)) void pngUnfilterPixels(unsigned char *row, const unsigned char *prior,
+                                                                    size_t length, int bpp, int filter) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, c = zero;
+
+    switch (filter) {
+    case PNG_FILTER_SUB:
+        for (size_t i = 0; i < length; i += bpp) {
+            a = _mm_add_epi8(a, pngLoadPixel(row + i, bpp));
+            pngStorePixel(row + i, a, bpp);
+        }
+        break;
+    case PNG_FILTER_AVG:
+        for (size_t i = 0; i < length; i += bpp) {
+            __m128i b = pngLoadPixel(prior + i, bpp);
+            // (a + b) >> 1 without overflow: the rounded-up average minus the carried-in bit
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            a = _mm_add_epi8(average, pngLoadPixel(row + i, bpp));
+            pngStorePixel(row + i, a, bpp);
+        }
+        break;
+    case PNG_FILTER_PAETH:
+        for (size_t i = 0; i < length; i += bpp) {
+            __m128i b = _mm_unpacklo_epi8(pngLoadPixel(prior + i, bpp), zero);
+            __m128i x = _mm_unpacklo_epi8(pngLoadPixel(row + i, bpp), zero);
+
+            // p = a + b - c: |p - a| = |b - c|, |p - b| = |a - c|, |p - c| = |(b - c) + (a - c)|
+            __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c);
+            __m128i pc = pngAbs16(_mm_add_epi16(pa, pb));
+            pa = pngAbs16(pa);
+            pb = pngAbs16(pb);
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+            // ties go to a, then b, as in pngPaeth
+            __m128i nearest = pngSelect(_mm_cmpeq_epi16(smallest, pa), a,
+                                        pngSelect(_mm_cmpeq_epi16(smallest, pb), b, c));
+            a = _mm_and_si128(_mm_add_epi16(nearest, x), _mm_set1_epi16(0xFF));
+            pngStorePixel(row + i, _mm_packus_epi16(a, a), bpp);
+            c = b;
+        }
+        break;
+    }
+}
+
+static int pngUnfilterSse2(unsigned char *row, const unsigned char *prior, size_t length, int bpp, int filter) {
+    if (filter == PNG_FILTER_UP) {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(row + i)),
+                                     _mm_loadu_si128((const __m128i *)(prior + i)));
+            _mm_storeu_si128((__m128i *)(row + i), v);
+        }
+        for (; i < length; i++) row[i] += prior[i];
+        return 0;
+    }
+    if (filter < PNG_FILTER_SUB || filter > PNG_FILTER_PAETH || (bpp != 3 && bpp != 4)) {
+        return pngUnfilterScalar(row, prior, length, bpp, filter);
+    }
+
+    if (bpp == 3) {
+        pngUnfilterPixels(row, prior, length, 3, filter);
+    } else {
+        pngUnfilterPixels(row, prior, length, 4, filter);
+    }
+    return 0;
+}
+
+// Only Up gains from wider vectors
+__attribute__((target("avx2")))
+static int pngUnfilterAvx2(unsigned char *row, const unsigned char *prior, size_t length, int bpp, int filter) {
+    if (filter != PNG_FILTER_UP) return pngUnfilterSse2(row, prior, length, bpp, filter);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(row + i)),
+                                    _mm256_loadu_si256((const __m256i *)(prior + i)));
+        _mm256_storeu_si256((__m256i *)(row + i), v);
+    }
+    for (; i < length; i++) row[i] += prior[i];
+    return 0;
+}
+#endif
+
+// ------------------------------------------------------------
+// Filter score: sum of the filtered bytes taken as signed values
+// (|-128| counts 128). Smaller sums tend to compress better.
+// ------------------------------------------------------------
+typedef uint64_t (*pngScoreFn)(const unsigned char *filtered, size_t length);
+
+static uint64_t pngScoreScalar(const unsigned char *filtered, size_t length) {
+    uint64_t score = 0;
+    for (size_t i = 0; i < length; i++) score += abs((signed char)filtered[i]);
+    return score;
+}
+
+#ifdef CPU_X86
+static uint64_t pngScoreSse2(const unsigned char *filtered, size_t length) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(filtered + i));
+        __m128i sign = _mm_cmpgt_epi8(zero, v);
+        __m128i magnitude = _mm_sub_epi8(_mm_xor_si128(v, sign), sign); // -128 becomes 0x80 = 128
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(magnitude, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    return lanes[0] + lanes[1] + pngScoreScalar(filtered + i, length - i);
+}
+
+__attribute__((target("avx2,bmi2")))
+static uint64_t pngScoreAvx2(const unsigned char *filtered, size_t length) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero;
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(filtered + i));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_abs_epi8(v), zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + pngScoreScalar(filtered + i, length - i);
+}
+
+__attribute__((target("avx512bw,bmi2")))
+static uint64_t pngScoreAvx512(const unsigned char *filtered, size_t length) {
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i sum = zero;
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512(filtered + i);
+        sum = _mm512_add_epi64(sum, _mm512_sad_epu8(_mm512_abs_epi8(v), zero));
+    }
+    if (i < length) {
+        __mmask64 tail = _bzhi_u64(~0ULL, (unsigned)(length - i));
+        __m512i v = _mm512_maskz_loadu_epi8(tail, filtered + i);
+        sum = _mm512_add_epi64(sum, _mm512_sad_epu8(_mm512_abs_epi8(v), zero));
+    }
+    return (uint64_t)_mm512_reduce_add_epi64(sum);
+}
+#endif
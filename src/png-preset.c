@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define presetMkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define presetMkdir(path) mkdir(path, 0755)
+#endif
+
+// ------------------------------------------------------------
+// Filter choice when re-encoding
+// Flipping the lowest bits hardly changes which filter suits a row
+// best, so the writer can take over the filter each row had in the
+// input instead of trying all five. Rows that carry payload bits
+// changed the most; by default only the rows after the payload
+// reuse their filter. Palette images expanded to RGB always choose
+// anew (their input filters were picked for the indices).
+// ------------------------------------------------------------
+enum { PNG_FILTERS_CHOOSE, PNG_FILTERS_REUSE_TAIL, PNG_FILTERS_REUSE };
+
+static int pngFilterReuse = PNG_FILTERS_REUSE_TAIL;
+
+// ------------------------------------------------------------
+// PNG presets (--png-preset)
+// A preset sets the deflate level of the writer and the filter
+// choice above. "auto" takes a budget in milliseconds per megapixel
+// and picks the smallest preset whose embedding stays within it.
+//
+// A synthetic image can't stand in for a photo directly (it has
+// none of the long repeats that make the high levels slow), so the
+// estimate is a reference cost, measured once for a photo, scaled
+// by how much faster or slower this machine encodes the synthetic
+// calibration image than the reference machine did. The
+// calibration runs once and is kept in a cache file, one line per
+// ISA and thread count (both change the speed).
+// ------------------------------------------------------------
+struct pngPreset {
+    const char *name;
+    int level;
+    int reuse;
+    double photoMs;     // reference: embedding into a 1.3 megapixel photo, ms per megapixel
+    double syntheticMs; // reference: encoding the calibration image, ms per megapixel
+};
+
+// References from one AVX-512 core (--threads 1)
+static const struct pngPreset pngPresets[] = {
+    { "fastest", 1, PNG_FILTERS_REUSE, 250, 240 },
+    { "balanced", 6, PNG_FILTERS_REUSE_TAIL, 360, 350 },
+    { "smallest", 9, PNG_FILTERS_CHOOSE, 650, 370 },
+};
+
+#define PNG_PRESET_COUNT 3
+#define PNG_AUTO_BUDGET 400    // ms per megapixel for a plain "auto"
+#define PNG_CALIBRATE_SIZE 512 // width and height of the calibration image
+#define PNG_CACHE_VERSION 1
+
+static void pngPresetApply(const struct pngPreset *preset) {
+    pngLevel = preset->level;
+    pngFilterReuse = preset->reuse;
+}
+
+// Directory for the calibration cache (malloc'ed, created if needed);
+// falls back to the temp directory
+static char *pngCacheDir(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *sub = "stego";
+    char *dir = NULL;
+
+    if (base == NULL || *base == '\0') {
+        base = getenv("LOCALAPPDATA");
+    }
+    if (base == NULL || *base == '\0') {
+        base = getenv("HOME");
+        sub = ".cache/stego";
+    }
+    if (base != NULL && *base != '\0' && asprintf(&dir, "%s/%s", base, sub) >= 0) {
+        // create the path step by step, like mkdir -p
+        for (char *p = dir + 1; ; p++) {
+            if (*p == '/' || *p == '\0') {
+                char c = *p;
+                *p = '\0';
+                presetMkdir(dir);
+                *p = c;
+                if (c == '\0') break;
+            }
+        }
+        return dir;
+    }
+
+    base = getenv("TMPDIR");
+    if (base == NULL) base = getenv("TEMP");
+    return strdup(base != NULL ? base : ".");
+}
+
+// ------------------------------------------------------------
+// Function: pngPresetCalibrate
+// Purpose : Measures the encoding time of every preset in ms per
+//           megapixel, on a synthetic image (gradients plus noise)
+//           written through the stream writer
+// Method  : Presets that reuse filters get a Paeth hint for every
+//           row, as if the input had used it. Best of two runs.
+// Returns : 0 on success, -1 if the test file couldn't be written
+// ------------------------------------------------------------
+static int pngPresetCalibrate(const char *scratch, double msPerMegapixel[PNG_PRESET_COUNT]) {
+    int size = PNG_CALIBRATE_SIZE;
+    unsigned char *row = malloc((size_t)size * 3);
+    if (!row) return -1;
+
+    int savedLevel = pngLevel, savedReuse = pngFilterReuse, result = 0;
+    for (int p = 0; p < PNG_PRESET_COUNT && result == 0; p++) {
+        pngPresetApply(&pngPresets[p]);
+        for (int run = 0; run < 2 && result == 0; run++) {
+            uint32_t seed = 12345;
+            int noise[3] = { 0 };
+            struct pngStream out;
+            double start = timeNow();
+
+            if (pngStreamOpen(&out, scratch, size, size, 3, NULL) != 0) {
+                result = -1;
+                break;
+            }
+            for (int y = 0; y < size && result == 0; y++) {
+                for (int x = 0; x < size; x++) {
+                    seed = seed * 1103515245 + 12345;
+                    for (int c = 0; c < 3; c++) noise[c] = (noise[c] + (int)((seed >> (8 + 5 * c)) & 31)) / 2;
+                    row[3 * x] = (unsigned char)(x / 3 + y / 5 + noise[0]);
+                    row[3 * x + 1] = (unsigned char)(y / 3 + x / 7 + noise[1]);
+                    row[3 * x + 2] = (unsigned char)((x + y) / 6 + noise[2]);
+                }
+                int hint = pngFilterReuse == PNG_FILTERS_CHOOSE ? -1 : PNG_FILTER_PAETH;
+                if (pngStreamRow(&out, row, hint) != 0) result = -1;
+            }
+            if (result != 0) {
+                pngStreamFree(&out);
+            } else if (pngStreamClose(&out) != 0) {
+                result = -1;
+            }
+
+            double ms = (timeNow() - start) * 1e3 / ((double)size * size / 1e6);
+            if (run == 0 || ms < msPerMegapixel[p]) msPerMegapixel[p] = ms;
+        }
+    }
+    remove(scratch);
+    pngLevel = savedLevel;
+    pngFilterReuse = savedReuse;
+    free(row);
+    return result;
+}
+
+// Looks up (isa, threads) in the cache file; returns 0 if found
+static int pngCacheRead(const char *path, const char *key, double msPerMegapixel[PNG_PRESET_COUNT]) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[256], name[64];
+    int version = 0, result = -1;
+    if (fgets(line, sizeof(line), f) && sscanf(line, "stego-png-presets %d", &version) == 1 &&
+        version == PNG_CACHE_VERSION) {
+        while (result != 0 && fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "%63s %lf %lf %lf", name, &msPerMegapixel[0], &msPerMegapixel[1],
+                       &msPerMegapixel[2]) == 4 && strcmp(name, key) == 0) {
+                result = 0;
+            }
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+// Stores the measurement for (isa, threads), keeping the other lines
+static void pngCacheWrite(const char *path, const char *key, const double msPerMegapixel[PNG_PRESET_COUNT]) {
+    char lines[64][256], name[64], line[256];
+    int count = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f) {
+        int version = 0;
+        if (fgets(line, sizeof(line), f) && sscanf(line, "stego-png-presets %d", &version) == 1 &&
+            version == PNG_CACHE_VERSION) {
+            while (count < 63 && fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "%63s", name) == 1 && strcmp(name, key) != 0) strcpy(lines[count++], line);
+            }
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (!f) return; // no cache then, the next run measures again
+    fprintf(f, "stego-png-presets %d\n", PNG_CACHE_VERSION);
+    for (int i = 0; i < count; i++) fputs(lines[i], f);
+    fprintf(f, "%s %.1f %.1f %.1f\n", key, msPerMegapixel[0], msPerMegapixel[1], msPerMegapixel[2]);
+    fclose(f);
+}
+
+// ------------------------------------------------------------
+// Function: pngPresetAuto
+// Purpose : Picks the smallest preset whose estimated embedding time
+//           fits `budget` ms per megapixel (fastest if none does)
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+static int pngPresetAuto(double budget) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s/%dt", isaNames[kernels.isa], threadCount);
+
+    char *dir = pngCacheDir();
+    char *cache = NULL, *scratch = NULL;
+    if (!dir || asprintf(&cache, "%s/png-presets", dir) < 0 || asprintf(&scratch, "%s/calibrate.png", dir) < 0) {
+        printf("Out of memory.\n");
+        free(dir);
+        free(cache);
+        return -1;
+    }
+
+    double ms[PNG_PRESET_COUNT];
+    int result = 0;
+    if (pngCacheRead(cache, key, ms) != 0) {
+        printf("Calibrating the PNG presets for this machine (%s)...\n", key);
+        if (pngPresetCalibrate(scratch, ms) == 0) {
+            pngCacheWrite(cache, key, ms);
+        } else {
+            printf("Could not write the calibration image %s.\n", scratch);
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        int chosen = 0;
+        double estimate[PNG_PRESET_COUNT];
+        for (int p = 0; p < PNG_PRESET_COUNT; p++) {
+            estimate[p] = pngPresets[p].photoMs * ms[p] / pngPresets[p].syntheticMs;
+        }
+        for (int p = PNG_PRESET_COUNT - 1; p > 0 && chosen == 0; p--) {
+            if (estimate[p] <= budget) chosen = p;
+        }
+        pngPresetApply(&pngPresets[chosen]);
+        printf("PNG preset: %s (about %.0f ms per megapixel, budget %.0f)\n", pngPresets[chosen].name,
+               estimate[chosen], budget);
+    }
+    free(dir);
+    free(cache);
+    free(scratch);
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: pngPresetSet
+// Purpose : Applies a --png-preset value: fastest, balanced,
+//           smallest, or auto[:ms per megapixel]
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int pngPresetSet(const char *value) {
+    for (int p = 0; p < PNG_PRESET_COUNT; p++) {
+        if (strcmp(value, pngPresets[p].name) == 0) {
+            pngPresetApply(&pngPresets[p]);
+            return 0;
+        }
+    }
+
+    if (strcmp(value, "auto") == 0) return pngPresetAuto(PNG_AUTO_BUDGET);
+    if (strncmp(value, "auto:", 5) == 0) {
+        char *end;
+        double budget = strtod(value + 5, &end);
+        if (value[5] != '\0' && *end == '\0' && budget > 0) return pngPresetAuto(budget);
+    }
+
+    printf("Invalid PNG preset \"%s\" (use fastest, balanced, smallest or auto[:ms per megapixel]).\n", value);
+    return -1;
+}
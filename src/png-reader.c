@@ -0,0 +1,390 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// Streaming PNG reader
+// Decodes a PNG one row at a time: IDAT data is pulled from the
+// file only as far as the inflater needs it, and every row is
+// unfiltered right after it has been inflated. Callers that only
+// need the top of the image (extraction) stop reading early.
+//
+// Covers the layouts we embed into: 8 bit RGB, RGBA and palette
+// images, non-interlaced. Everything else is reported as
+// PNG_UNSUPPORTED so the caller can fall back to stb_image.
+// Palette rows are expanded to RGB unless keepIndices is set.
+//
+// Files from our writer carry a stIX chunk listing segments that can
+// be decoded on their own (see png-writer.c); pngSegmentOpen gives a
+// reader for one of them, so several threads can decode at once.
+// ------------------------------------------------------------
+#define PNG_UNSUPPORTED 1
+#define PNG_READ_CHUNK (1 << 16)
+
+enum { PNG_GRAY = 0, PNG_RGB = 2, PNG_PALETTE = 3, PNG_GRAY_ALPHA = 4, PNG_RGBA = 6 };
+
+static const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// PLTE + tRNS of an indexed image
+struct pngPalette {
+    unsigned char colors[256 * 3];
+    unsigned char alpha[256];
+    int size;      // entries in PLTE
+    int alphaSize; // entries in tRNS (0 = opaque)
+};
+
+struct pngReader {
+    FILE *file;
+    char *path;
+    int width, height;
+    int colorType;
+    int channels;          // bytes per pixel of the rows handed out
+    int bpp;               // bytes per pixel in the file (filter distance)
+    size_t rowBytes;       // bytes per row in the file, without the filter byte
+    int row;               // rows read so far
+    int filter;            // filter type of the row pngReadRow returned last
+
+    struct pngPalette palette;
+    int keepIndices;       // 1 = hand out palette indices instead of RGB
+
+    // stIX: independently decodable segments (segmentCount = 0 without one)
+    int segmentCount;
+    int *segmentRows;      // first row of every segment, + height
+    uint64_t *segmentOffsets; // file offset of every segment's IDAT chunk
+    uint32_t *segmentAdlers;  // Adler-32 of every segment's filtered rows (NULL in older indexes)
+
+    // IDAT input
+    uint32_t chunkLeft;    // bytes left in the current IDAT chunk
+    int idatDone;
+    unsigned char *input;
+    struct inflater z;
+
+    unsigned char *previous, *current; // filter byte + row
+    unsigned char *expanded;           // palette rows as RGB
+};
+
+static uint32_t pngGetU32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Reads the next chunk header; returns 0 on success
+static int pngChunkHeader(FILE *f, uint32_t *length, char type[5]) {
+    unsigned char header[8];
+    if (fread(header, 1, 8, f) != 8) return -1;
+
+    *length = pngGetU32(header);
+    memcpy(type, header + 4, 4);
+    type[4] = '\0';
+    return *length > 0x7FFFFFFF ? -1 : 0;
+}
+
+// Inflater refill: hands out the IDAT payload chunk by chunk,
+// skipping CRCs and stopping at the first non-IDAT chunk
+static size_t pngRefill(void *ctx, const unsigned char **data) {
+    struct pngReader *r = ctx;
+    char type[5];
+
+    while (r->chunkLeft == 0) {
+        if (r->idatDone) return 0;
+        if (fseek(r->file, 4, SEEK_CUR) != 0 || pngChunkHeader(r->file, &r->chunkLeft, type) != 0 ||
+            strcmp(type, "IDAT") != 0) {
+            r->idatDone = 1;
+            r->chunkLeft = 0;
+            return 0;
+        }
+    }
+
+    size_t n = r->chunkLeft < PNG_READ_CHUNK ? r->chunkLeft : PNG_READ_CHUNK;
+    n = fread(r->input, 1, n, r->file);
+    if (n == 0) {
+        r->idatDone = 1;
+        return 0;
+    }
+    r->chunkLeft -= (uint32_t)n;
+    *data = r->input;
+    return n;
+}
+
+// Row buffers for decoding (previous starts as the zero row)
+static int pngAllocRows(struct pngReader *r) {
+    r->input = malloc(PNG_READ_CHUNK);
+    r->previous = calloc(r->rowBytes + 1, 1);
+    r->current = malloc(r->rowBytes + 1);
+    if (r->colorType == PNG_PALETTE) r->expanded = malloc((size_t)r->width * 3);
+    return r->input && r->previous && r->current && (r->colorType != PNG_PALETTE || r->expanded) ? 0 : -1;
+}
+
+void pngClose(struct pngReader *r) {
+    if (r->file) fclose(r->file);
+    free(r->path);
+    free(r->segmentRows);
+    free(r->segmentOffsets);
+    free(r->segmentAdlers);
+    free(r->input);
+    free(r->previous);
+    free(r->current);
+    free(r->expanded);
+    memset(r, 0, sizeof(*r));
+}
+
+// ------------------------------------------------------------
+// Function: pngReadIndex
+// Purpose : Reads a stIX chunk (layout in pngIndexData) of `length`
+//           bytes; an index that doesn't add up is ignored
+// Returns : 0, or -1 if the file can't be read
+// ------------------------------------------------------------
+static int pngReadIndex(struct pngReader *r, uint32_t length) {
+    unsigned char *data = malloc(length > 0 ? length : 1);
+    if (!data || fread(data, 1, length, r->file) != length) {
+        free(data);
+        return -1;
+    }
+
+    // entries of 12 bytes (row + offset) or, since the Adler sums were added, 16
+    uint32_t count = length >= 4 ? pngGetU32(data) : 0;
+    uint64_t entry = count > 0 ? (length - 4) / count : 0;
+    int valid = count >= 2 && count <= (uint32_t)r->height && (entry == 12 || entry == 16) &&
+                length == 4 + (uint64_t)count * entry;
+    if (valid) {
+        r->segmentRows = malloc((count + 1) * sizeof(int));
+        r->segmentOffsets = malloc(count * sizeof(uint64_t));
+        r->segmentAdlers = entry == 16 ? malloc(count * sizeof(uint32_t)) : NULL;
+        valid = r->segmentRows && r->segmentOffsets && (entry == 12 || r->segmentAdlers);
+    }
+    for (uint32_t k = 0; k < count && valid; k++) {
+        const unsigned char *p = data + 4 + k * entry;
+        uint32_t row = pngGetU32(p);
+        r->segmentRows[k] = (int)row;
+        r->segmentOffsets[k] = ((uint64_t)pngGetU32(p + 4) << 32) | pngGetU32(p + 8);
+        if (r->segmentAdlers) r->segmentAdlers[k] = pngGetU32(p + 12);
+        valid = k == 0 ? row == 0 : row > (uint32_t)r->segmentRows[k - 1] && row < (uint32_t)r->height &&
+                                        r->segmentOffsets[k] > r->segmentOffsets[k - 1];
+    }
+
+    if (valid) {
+        r->segmentCount = (int)count;
+        r->segmentRows[count] = r->height;
+    } else {
+        free(r->segmentRows);
+        free(r->segmentOffsets);
+        free(r->segmentAdlers);
+        r->segmentRows = NULL;
+        r->segmentOffsets = NULL;
+        r->segmentAdlers = NULL;
+    }
+    free(data);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: pngOpen
+// Purpose : Parses the chunks up to the first IDAT and prepares
+//           row-by-row decoding
+// Returns : 0 on success, PNG_UNSUPPORTED for layouts this reader
+//           doesn't handle, -1 if the file is not a readable PNG
+// ------------------------------------------------------------
+int pngOpen(struct pngReader *r, const char *path) {
+    unsigned char buffer[256 * 3];
+    uint32_t length;
+    char type[5];
+
+    memset(r, 0, sizeof(*r));
+    r->file = fopen(path, "rb");
+    if (!r->file) return -1;
+    if ((r->path = malloc(strlen(path) + 1)) == NULL) {
+        pngClose(r);
+        return -1;
+    }
+    strcpy(r->path, path);
+
+    if (fread(buffer, 1, 8, r->file) != 8 || memcmp(buffer, pngSignature, 8) != 0 ||
+        pngChunkHeader(r->file, &length, type) != 0) {
+        pngClose(r);
+        return -1;
+    }
+
+    // IHDR has to come first (Apple's CgBI variant doesn't, stb handles that one)
+    if (strcmp(type, "IHDR") != 0 || length != 13 || fread(buffer, 1, 13, r->file) != 13) {
+        pngClose(r);
+        return PNG_UNSUPPORTED;
+    }
+
+    uint32_t width = pngGetU32(buffer), height = pngGetU32(buffer + 4);
+    int bitDepth = buffer[8], interlace = buffer[12];
+    r->colorType = buffer[9];
+
+    if (width == 0 || height == 0 || width > (1 << 24) || height > (1 << 24)) {
+        pngClose(r);
+        return -1;
+    }
+    if (bitDepth != 8 || interlace != 0 ||
+        (r->colorType != PNG_RGB && r->colorType != PNG_RGBA && r->colorType != PNG_PALETTE)) {
+        pngClose(r);
+        return PNG_UNSUPPORTED;
+    }
+
+    r->width = (int)width;
+    r->height = (int)height;
+    r->bpp = r->colorType == PNG_RGBA ? 4 : r->colorType == PNG_RGB ? 3 : 1;
+    r->rowBytes = (size_t)width * r->bpp;
+
+    // Walk the chunks before the image data
+    for (;;) {
+        if (fseek(r->file, 4, SEEK_CUR) != 0 || pngChunkHeader(r->file, &length, type) != 0) {
+            pngClose(r);
+            return -1;
+        }
+        if (strcmp(type, "IDAT") == 0) break;
+
+        if (strcmp(type, "PLTE") == 0) {
+            if (length > sizeof(buffer) || length % 3 != 0 || fread(buffer, 1, length, r->file) != length) {
+                pngClose(r);
+                return -1;
+            }
+            memcpy(r->palette.colors, buffer, length);
+            r->palette.size = (int)length / 3;
+        } else if (strcmp(type, "tRNS") == 0 && r->colorType == PNG_PALETTE) {
+            // Transparency only adds an alpha channel, which never carries bits;
+            // for other color types the chunk can simply be skipped
+            if (length > 256 || fread(r->palette.alpha, 1, length, r->file) != length) {
+                pngClose(r);
+                return -1;
+            }
+            r->palette.alphaSize = (int)length;
+        } else if (strcmp(type, "stIX") == 0 && r->segmentCount == 0) {
+            if (pngReadIndex(r, length) != 0) {
+                pngClose(r);
+                return -1;
+            }
+        } else if (strcmp(type, "IEND") == 0 || fseek(r->file, length, SEEK_CUR) != 0) {
+            pngClose(r);
+            return -1;
+        }
+    }
+
+    if (r->colorType == PNG_PALETTE && r->palette.size == 0) {
+        pngClose(r);
+        return -1;
+    }
+
+    r->chunkLeft = length;
+    r->channels = r->colorType == PNG_PALETTE ? 3 : r->bpp;
+    if (pngAllocRows(r) != 0) {
+        pngClose(r);
+        return -1;
+    }
+
+    inflateInit(&r->z, pngRefill, r, 0);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: pngSegmentOpen
+// Purpose : Opens segment `segment` of the stIX index of r as a
+//           reader of its own: pngReadRow starts at the segment's
+//           first row (r->row of the new reader) and stops after its
+//           last one (height). Settings like pngKeepIndices carry over.
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int pngSegmentOpen(const struct pngReader *r, int segment, struct pngReader *out) {
+    char type[5];
+
+    memset(out, 0, sizeof(*out));
+    if (segment < 0 || segment >= r->segmentCount) return -1;
+
+    out->width = r->width;
+    out->height = r->segmentRows[segment + 1];
+    out->row = r->segmentRows[segment];
+    out->colorType = r->colorType;
+    out->channels = r->channels;
+    out->bpp = r->bpp;
+    out->rowBytes = r->rowBytes;
+    out->palette = r->palette;
+    out->keepIndices = r->keepIndices;
+
+    // fseek takes a long, which is 32 bits on some systems
+    out->file = fopen(r->path, "rb");
+    if (!out->file || r->segmentOffsets[segment] > (uint64_t)LONG_MAX ||
+        fseek(out->file, (long)r->segmentOffsets[segment], SEEK_SET) != 0 ||
+        pngChunkHeader(out->file, &out->chunkLeft, type) != 0 || strcmp(type, "IDAT") != 0 ||
+        pngAllocRows(out) != 0) {
+        pngClose(out);
+        return -1;
+    }
+
+    // only the first segment starts with the zlib header
+    inflateInit(&out->z, pngRefill, out, segment > 0);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: pngSegmentsCopyable
+// Purpose : Tells whether segments first.. of the stIX index can be
+//           copied into another file as they are: the index has
+//           their Adler sums, and every segment is exactly one IDAT
+//           chunk (the next segment's chunk, or a non-IDAT chunk
+//           after the last one, follows directly)
+// Returns : 1 if so, 0 otherwise
+// ------------------------------------------------------------
+int pngSegmentsCopyable(const struct pngReader *r, int first) {
+    if (!r->segmentAdlers || first < 0 || first >= r->segmentCount) return 0;
+
+    FILE *f = fopen(r->path, "rb");
+    int copyable = f != NULL;
+    for (int k = first; k < r->segmentCount && copyable; k++) {
+        uint32_t length;
+        char type[5];
+        copyable = r->segmentOffsets[k] <= (uint64_t)LONG_MAX &&
+                   fseek(f, (long)r->segmentOffsets[k], SEEK_SET) == 0 &&
+                   pngChunkHeader(f, &length, type) == 0 && strcmp(type, "IDAT") == 0;
+        if (!copyable) break;
+
+        uint64_t next = r->segmentOffsets[k] + 12 + length;
+        if (k + 1 < r->segmentCount) {
+            copyable = r->segmentOffsets[k + 1] == next;
+        } else {
+            copyable = next <= (uint64_t)LONG_MAX && fseek(f, (long)next, SEEK_SET) == 0 &&
+                       pngChunkHeader(f, &length, type) == 0 && strcmp(type, "IDAT") != 0;
+        }
+    }
+    if (f) fclose(f);
+    return copyable;
+}
+
+// Makes pngReadRow hand out the raw indices of a palette image
+// (channels becomes 1); no effect on other images
+void pngKeepIndices(struct pngReader *r) {
+    if (r->colorType != PNG_PALETTE) return;
+    r->keepIndices = 1;
+    r->channels = 1;
+}
+
+// ------------------------------------------------------------
+// Function: pngReadRow
+// Purpose : Inflates and unfilters the next row
+// Returns : Pointer to width * channels bytes (width bytes for kept
+//           palette indices), valid until the next call; NULL at the
+//           end of the image or on corrupt data
+// ------------------------------------------------------------
+unsigned char *pngReadRow(struct pngReader *r) {
+    if (r->row >= r->height) return NULL;
+
+    if (inflateRead(&r->z, r->current, r->rowBytes + 1) != r->rowBytes + 1) return NULL;
+    if (kernels.pngUnfilter(r->current + 1, r->previous + 1, r->rowBytes, r->bpp, r->current[0]) != 0) return NULL;
+    r->filter = r->current[0];
+
+    unsigned char *swap = r->previous;
+    r->previous = r->current;
+    r->current = swap;
+    r->row++;
+
+    unsigned char *pixels = r->previous + 1;
+    if (r->colorType != PNG_PALETTE || r->keepIndices) return pixels;
+
+    for (int x = 0; x < r->width; x++) {
+        memcpy(r->expanded + 3 * x, r->palette.colors + 3 * pixels[x], 3);
+    }
+    return r->expanded;
+}
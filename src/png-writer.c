@@ -0,0 +1,663 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// PNG writer
+// Writes 8 bit RGB / RGBA and palette images. Rows are filtered like
+// stb_image_write does (the filter with the smallest sum of
+// absolute differences wins), and the filtered image is cut into
+// segments of whole rows that are deflated in parallel, pigz style.
+// Every segment is compressed without history, ends with a full
+// flush and becomes one IDAT chunk; its first row only uses filters
+// that don't look at the row above. So a segment can be decoded
+// without the ones in front of it, and the private stIX chunk tells
+// readers where the segments start (see pngIndexData). The
+// per-segment Adler-32 sums are combined into the zlib trailer, so
+// the result is one ordinary zlib stream that any decoder reads.
+// The index keeps those sums as well: a later embed into the file
+// can copy the segments it doesn't change as they are
+// (pngStreamCopy) and still compute the new trailer.
+// Palette rows are always written unfiltered: differences between
+// indices say nothing about the colors, so filters only hurt there.
+//
+// Segment boundaries only depend on the image, never on the number
+// of threads, so the output is the same for every --threads value.
+// ------------------------------------------------------------
+#define PNG_BLOCK_BYTES (256 << 10) // filtered bytes per segment (rounded to whole rows)
+
+static int pngLevel = 6; // deflate level (see zLevels), set by --png-preset
+
+static uint32_t pngCrcTable[256];
+
+static void pngCrcInit(void) {
+    if (pngCrcTable[1] != 0) return;
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        pngCrcTable[n] = c;
+    }
+}
+
+// CRC-32 of the PNG chunks (start with crc = 0)
+uint32_t pngCrc(uint32_t crc, const unsigned char *data, size_t length) {
+    crc = ~crc;
+    while (length--) crc = pngCrcTable[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void pngPutU32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+// Writes one chunk; crc has to cover type + data (see pngChunkCrc)
+static int pngWriteChunk(FILE *f, const char *type, const unsigned char *data, size_t length, uint32_t crc) {
+    unsigned char header[8], trailer[4];
+    pngPutU32(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+    pngPutU32(trailer, crc);
+
+    if (fwrite(header, 1, 8, f) != 8) return -1;
+    if (length > 0 && fwrite(data, 1, length, f) != length) return -1;
+    return fwrite(trailer, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static uint32_t pngChunkCrc(const char *type, const unsigned char *data, size_t length) {
+    return pngCrc(pngCrc(0, (const unsigned char *)type, 4), data, length);
+}
+
+static void pngPutU64(unsigned char *p, uint64_t value) {
+    pngPutU32(p, (uint32_t)(value >> 32));
+    pngPutU32(p + 4, (uint32_t)value);
+}
+
+// ------------------------------------------------------------
+// Segments
+// Segment k starts with the first row whose filter byte lies at or
+// behind k * PNG_BLOCK_BYTES of the filtered image (rows wider than
+// a block make segments of one row). rows[count] is set to height.
+// Returns the number of segments; rows may be NULL to only count.
+// ------------------------------------------------------------
+static int pngSegmentRows(size_t line, int height, int *rows) {
+    int count = 0;
+    size_t previous = SIZE_MAX;
+
+    for (size_t b = 0;; b++) {
+        size_t y = (b * PNG_BLOCK_BYTES + line - 1) / line;
+        if (y >= (size_t)height) break;
+        if (y == previous) continue;
+        if (rows) rows[count] = (int)y;
+        count++;
+        previous = y;
+    }
+    if (rows) rows[count] = height;
+    return count;
+}
+
+// Filter choice for a row: palette rows stay unfiltered, and the first
+// row of a segment may not depend on the row above
+static int pngLastFilter(int indexed, int segmentStart) {
+    if (indexed) return PNG_FILTER_NONE;
+    return segmentStart ? PNG_FILTER_SUB : PNG_FILTER_PAETH;
+}
+
+// ------------------------------------------------------------
+// Function: pngIndexData
+// Purpose : Builds the data of the stIX chunk (private, ancillary,
+//           unsafe to copy): a 32 bit segment count, then per
+//           segment its first row (32 bit), the file offset of its
+//           IDAT chunk (64 bit) and the Adler-32 of its filtered rows
+//           (32 bit), all big endian
+// Returns : malloc'ed data, NULL if out of memory
+// ------------------------------------------------------------
+#define PNG_INDEX_ENTRY 16
+
+static unsigned char *pngIndexData(int count, const int *rows, const uint64_t *offsets, const uint32_t *adlers,
+                                   size_t *length) {
+    *length = 4 + (size_t)count * PNG_INDEX_ENTRY;
+    unsigned char *data = malloc(*length);
+    if (!data) return NULL;
+
+    pngPutU32(data, (uint32_t)count);
+    for (int k = 0; k < count; k++) {
+        unsigned char *entry = data + 4 + k * PNG_INDEX_ENTRY;
+        pngPutU32(entry, (uint32_t)rows[k]);
+        pngPutU64(entry + 4, offsets ? offsets[k] : 0);
+        pngPutU32(entry + 12, adlers ? adlers[k] : 0);
+    }
+    return data;
+}
+
+// ------------------------------------------------------------
+// Filter + deflate pipeline
+// Every segment is deflated on its own, so its rows are filtered
+// right before it. Workers take segments round robin and run both
+// steps, so every segment is filtered and compressed by the same
+// thread while the others work on theirs.
+// ------------------------------------------------------------
+struct pngBlock {
+    struct zwriter out;
+    uint32_t adler; // of the segment's uncompressed bytes
+    uint32_t crc;   // of the IDAT chunk holding the segment (last one: after the trailer)
+};
+
+struct pngJob {
+    const unsigned char *pixels;
+    int height, bpp;
+    size_t rowBytes;            // without the filter byte
+    const unsigned char *zeros; // prior row of the first row
+    int indexed;                // palette image: filter None only
+
+    unsigned char *filtered;
+    int blockCount;             // segments
+    int *segmentRows;           // first row of every segment
+    struct pngBlock *blocks;
+    atomic_int failed;          // set by any worker
+};
+
+// Picks the filter (up to `last`) with the smallest score for a row and
+// writes filter byte + row (scratch = two rows of working space)
+static int pngFilterBest(const unsigned char *row, const unsigned char *prior, size_t rowBytes, int bpp,
+                         int last, unsigned char *out, unsigned char *scratch[2]) {
+    uint64_t bestScore = UINT64_MAX;
+    int best = PNG_FILTER_NONE;
+
+    for (int filter = PNG_FILTER_NONE; filter <= last; filter++) {
+        unsigned char *trial = scratch[1];
+        pngFilterRow(trial, row, prior, rowBytes, bpp, filter);
+        uint64_t score = kernels.pngScore(trial, rowBytes);
+        if (score < bestScore) {
+            bestScore = score;
+            best = filter;
+            scratch[1] = scratch[0]; // keep the winner in scratch[0]
+            scratch[0] = trial;
+        }
+    }
+
+    out[0] = (unsigned char)best;
+    memcpy(out + 1, scratch[0], rowBytes);
+    return best;
+}
+
+// Filters the rows of segment `segment`
+static void pngFilterSegment(struct pngJob *job, int segment) {
+    size_t line = job->rowBytes + 1;
+
+    unsigned char *buffer = malloc(2 * job->rowBytes);
+    if (!buffer) {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+    unsigned char *scratch[2] = { buffer, buffer + job->rowBytes };
+
+    for (int y = job->segmentRows[segment]; y < job->segmentRows[segment + 1]; y++) {
+        const unsigned char *row = job->pixels + (size_t)y * job->rowBytes;
+        const unsigned char *prior = y > 0 ? row - job->rowBytes : job->zeros;
+        int last = pngLastFilter(job->indexed, y == job->segmentRows[segment]);
+        pngFilterBest(row, prior, job->rowBytes, job->bpp, last, job->filtered + (size_t)y * line, scratch);
+    }
+    free(buffer);
+}
+
+static void pngDeflatePart(void *ctx, int index, int count) {
+    struct pngJob *job = ctx;
+    size_t line = job->rowBytes + 1;
+
+    for (int b = index; b < job->blockCount; b += count) {
+        struct pngBlock *block = &job->blocks[b];
+        const unsigned char *data = job->filtered + (size_t)job->segmentRows[b] * line;
+        size_t length = (size_t)(job->segmentRows[b + 1] - job->segmentRows[b]) * line;
+        int last = b == job->blockCount - 1;
+
+        pngFilterSegment(job, b);
+
+        if (b == 0) deflateHeader(&block->out);
+        if (atomic_load(&job->failed) || deflateRange(data, 0, length, length, pngLevel, last, &block->out) != 0) {
+            atomic_store(&job->failed, 1);
+            return;
+        }
+        block->adler = adler32(1, data, length);
+        if (!last) block->crc = pngChunkCrc("IDAT", block->out.data, block->out.size);
+    }
+}
+
+// Writes signature, IHDR and (for palette images) PLTE / tRNS;
+// returns the number of bytes written, 0 on error
+static uint64_t pngWriteHead(FILE *f, int width, int height, int channels, const struct pngPalette *palette) {
+    unsigned char ihdr[13];
+    pngPutU32(ihdr, (uint32_t)width);
+    pngPutU32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8;
+    ihdr[9] = palette ? PNG_PALETTE : channels == 4 ? PNG_RGBA : PNG_RGB;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    uint64_t written = 8 + 12 + 13;
+    int result = fwrite(pngSignature, 1, 8, f) == 8 ? 0 : -1;
+    if (result == 0) result = pngWriteChunk(f, "IHDR", ihdr, 13, pngChunkCrc("IHDR", ihdr, 13));
+    if (result == 0 && palette) {
+        size_t length = (size_t)palette->size * 3;
+        result = pngWriteChunk(f, "PLTE", palette->colors, length, pngChunkCrc("PLTE", palette->colors, length));
+        written += 12 + length;
+    }
+    if (result == 0 && palette && palette->alphaSize > 0) {
+        size_t length = (size_t)palette->alphaSize;
+        result = pngWriteChunk(f, "tRNS", palette->alpha, length, pngChunkCrc("tRNS", palette->alpha, length));
+        written += 12 + length;
+    }
+    return result == 0 ? written : 0;
+}
+
+// Checks the pngWrite / pngStreamOpen arguments
+static int pngLayoutValid(int width, int height, int channels, const struct pngPalette *palette) {
+    if (width <= 0 || height <= 0) return 0;
+    if (palette) {
+        return channels == 1 && palette->size >= 1 && palette->size <= 256 && palette->alphaSize <= palette->size;
+    }
+    return channels == 3 || channels == 4;
+}
+
+// Adds the zlib trailer and writes the chunks of a compressed image
+static int pngWriteFile(const char *path, struct pngJob *job, int width, int height, int channels,
+                        const struct pngPalette *palette) {
+    size_t line = job->rowBytes + 1;
+
+    // Adler-32 over all segments
+    uint32_t adler = 1;
+    for (int b = 0; b < job->blockCount; b++) {
+        size_t length = (size_t)(job->segmentRows[b + 1] - job->segmentRows[b]) * line;
+        adler = adler32Combine(adler, job->blocks[b].adler, length);
+    }
+    struct pngBlock *tail = &job->blocks[job->blockCount - 1];
+    for (int i = 3; i >= 0; i--) zwByte(&tail->out, (unsigned char)(adler >> (8 * i)));
+    if (tail->out.failed) return -1;
+    tail->crc = pngChunkCrc("IDAT", tail->out.data, tail->out.size);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    uint64_t offset = pngWriteHead(f, width, height, channels, palette);
+    int result = offset > 0 ? 0 : -1;
+
+    // Index in front of the image data; the chunk offsets follow from the block sizes
+    if (result == 0 && job->blockCount > 1) {
+        size_t length = 4 + (size_t)job->blockCount * PNG_INDEX_ENTRY;
+        uint64_t *offsets = malloc(job->blockCount * sizeof(*offsets));
+        uint32_t *adlers = malloc(job->blockCount * sizeof(*adlers));
+        unsigned char *index = NULL;
+        if (offsets && adlers) {
+            offset += 12 + length;
+            for (int b = 0; b < job->blockCount; b++) {
+                offsets[b] = offset;
+                adlers[b] = job->blocks[b].adler;
+                offset += 12 + job->blocks[b].out.size;
+            }
+            index = pngIndexData(job->blockCount, job->segmentRows, offsets, adlers, &length);
+        }
+        result = index ? pngWriteChunk(f, "stIX", index, length, pngChunkCrc("stIX", index, length)) : -1;
+        free(offsets);
+        free(adlers);
+        free(index);
+    }
+
+    for (int b = 0; b < job->blockCount && result == 0; b++) {
+        struct zwriter *out = &job->blocks[b].out;
+        result = pngWriteChunk(f, "IDAT", out->data, out->size, job->blocks[b].crc);
+    }
+    if (result == 0) result = pngWriteChunk(f, "IEND", NULL, 0, pngChunkCrc("IEND", NULL, 0));
+    if (fclose(f) != 0) result = -1;
+    return result;
+}
+
+// ------------------------------------------------------------
+// Function: pngWrite
+// Purpose : Writes pixels (rows without padding) as a PNG file;
+//           with a palette, pixels are 1 byte indices (channels 1)
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int pngWrite(const char *path, const unsigned char *pixels, int width, int height, int channels,
+             const struct pngPalette *palette) {
+    if (!pngLayoutValid(width, height, channels, palette)) return -1;
+    pngCrcInit();
+
+    struct pngJob job = { 0 };
+    job.pixels = pixels;
+    job.height = height;
+    job.bpp = channels;
+    job.indexed = palette != NULL;
+    job.rowBytes = (size_t)width * channels;
+    job.blockCount = pngSegmentRows(job.rowBytes + 1, height, NULL);
+    job.segmentRows = malloc((job.blockCount + 1) * sizeof(int));
+    job.zeros = calloc(job.rowBytes, 1);
+    job.filtered = malloc((job.rowBytes + 1) * height);
+    job.blocks = calloc(job.blockCount, sizeof(*job.blocks));
+
+    int result = -1;
+    if (job.segmentRows && job.zeros && job.filtered && job.blocks) {
+        pngSegmentRows(job.rowBytes + 1, height, job.segmentRows);
+        parallelRun(threadsFor(job.blockCount, 1), pngDeflatePart, &job);
+        if (!atomic_load(&job.failed)) result = pngWriteFile(path, &job, width, height, channels, palette);
+    }
+
+    if (job.blocks) {
+        for (int b = 0; b < job.blockCount; b++) zwFree(&job.blocks[b].out);
+    }
+    free(job.blocks);
+    free(job.filtered);
+    free(job.segmentRows);
+    free((void *)job.zeros);
+    return result;
+}
+
+// ------------------------------------------------------------
+// Streaming writer
+// Takes the image row by row and keeps only the previous row and
+// one segment per thread. Whenever that many segments are complete
+// they are deflated in parallel and written as IDAT chunks. The
+// output is exactly what pngWrite writes; the stIX chunk is written
+// with zero offsets first and filled in at the end.
+//
+// The file is written under a temporary name and renamed when it is
+// complete, so the output may be the image that is being read.
+// ------------------------------------------------------------
+struct pngStream {
+    FILE *file;
+    char *path, *temporary;
+    size_t rowBytes;
+    int bpp, indexed;
+    int row;                 // rows received
+
+    unsigned char *prior;    // previous row, zeros before the first
+    unsigned char *work;     // two rows, handed to pngFilterBest as scratch
+    unsigned char *scratch[2];
+
+    int segmentCount, segmentsDone;
+    int *segmentRows;
+    uint64_t *offsets;       // file offset of every segment's IDAT chunk
+    uint32_t *adlers;        // Adler-32 of every segment's filtered rows
+    uint64_t written;        // bytes in the file so far
+    uint64_t indexOffset;    // where the stIX chunk is (0 = none)
+
+    unsigned char *buffer;   // filtered rows of the pending segments
+    size_t filled;
+    size_t *starts;          // buffer offset of every pending segment (+ end)
+    int blockSlots, pending;
+    struct pngBlock *blocks;
+    uint32_t adler;          // of everything deflated so far
+    int final;               // the pending segments end the image
+    atomic_int failed;       // set by any deflate worker
+
+    int hints;               // filter hints taken so far (see pngStreamRow)
+    int hintsOff;            // a check found a hint clearly worse: ignore them
+};
+
+static void pngStreamDeflatePart(void *ctx, int index, int count) {
+    struct pngStream *s = ctx;
+
+    for (int b = index; b < s->pending; b += count) {
+        struct pngBlock *block = &s->blocks[b];
+        const unsigned char *data = s->buffer + s->starts[b];
+        size_t length = s->starts[b + 1] - s->starts[b];
+        int last = s->final && b == s->pending - 1;
+
+        if (s->segmentsDone == 0 && b == 0) deflateHeader(&block->out);
+        if (deflateRange(data, 0, length, length, pngLevel, last, &block->out) != 0) atomic_store(&s->failed, 1);
+        block->adler = adler32(1, data, length);
+    }
+}
+
+// Deflates and writes the pending segments; final = 1 ends the zlib stream
+static int pngStreamFlush(struct pngStream *s, int final) {
+    s->starts[s->pending] = s->filled;
+    s->final = final;
+    parallelRun(threadsFor(s->pending, 1), pngStreamDeflatePart, s);
+
+    for (int b = 0; b < s->pending && !atomic_load(&s->failed); b++) {
+        struct zwriter *out = &s->blocks[b].out;
+        s->adler = adler32Combine(s->adler, s->blocks[b].adler, s->starts[b + 1] - s->starts[b]);
+        s->adlers[s->segmentsDone + b] = s->blocks[b].adler;
+
+        if (final && b == s->pending - 1) {
+            for (int i = 3; i >= 0; i--) zwByte(out, (unsigned char)(s->adler >> (8 * i)));
+        }
+        s->offsets[s->segmentsDone + b] = s->written;
+        s->written += 12 + out->size;
+        if (out->failed || pngWriteChunk(s->file, "IDAT", out->data, out->size,
+                                         pngChunkCrc("IDAT", out->data, out->size)) != 0) {
+            atomic_store(&s->failed, 1);
+        }
+    }
+    for (int b = 0; b < s->pending; b++) zwFree(&s->blocks[b].out);
+
+    s->segmentsDone += s->pending;
+    s->pending = 0;
+    s->filled = 0;
+    return atomic_load(&s->failed) ? -1 : 0;
+}
+
+void pngStreamFree(struct pngStream *s) {
+    if (s->file) {
+        fclose(s->file);
+        remove(s->temporary);
+    }
+    if (s->blocks) {
+        for (int b = 0; b < s->blockSlots; b++) zwFree(&s->blocks[b].out);
+    }
+    free(s->path);
+    free(s->temporary);
+    free(s->prior);
+    free(s->work);
+    free(s->segmentRows);
+    free(s->offsets);
+    free(s->adlers);
+    free(s->buffer);
+    free(s->starts);
+    free(s->blocks);
+    memset(s, 0, sizeof(*s));
+}
+
+// ------------------------------------------------------------
+// Function: pngStreamOpen
+// Purpose : Starts writing a PNG row by row (arguments as pngWrite)
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int pngStreamOpen(struct pngStream *s, const char *path, int width, int height, int channels,
+                  const struct pngPalette *palette) {
+    memset(s, 0, sizeof(*s));
+    if (!pngLayoutValid(width, height, channels, palette)) return -1;
+    pngCrcInit();
+
+    s->rowBytes = (size_t)width * channels;
+    s->bpp = channels;
+    s->indexed = palette != NULL;
+    s->adler = 1;
+    s->segmentCount = pngSegmentRows(s->rowBytes + 1, height, NULL);
+    s->blockSlots = threadsFor(s->segmentCount, 1);
+
+    s->segmentRows = malloc((s->segmentCount + 1) * sizeof(int));
+    if (!s->segmentRows) return -1;
+    pngSegmentRows(s->rowBytes + 1, height, s->segmentRows);
+
+    // room for the blockSlots largest segments
+    size_t largest = 0;
+    for (int k = 0; k < s->segmentCount; k++) {
+        size_t bytes = (size_t)(s->segmentRows[k + 1] - s->segmentRows[k]) * (s->rowBytes + 1);
+        if (bytes > largest) largest = bytes;
+    }
+
+    s->path = malloc(strlen(path) + 1);
+    s->temporary = malloc(strlen(path) + 5);
+    s->prior = calloc(s->rowBytes, 1);
+    s->work = malloc(2 * s->rowBytes);
+    s->offsets = calloc(s->segmentCount, sizeof(*s->offsets));
+    s->adlers = calloc(s->segmentCount, sizeof(*s->adlers));
+    s->buffer = malloc(s->blockSlots * largest);
+    s->starts = malloc((s->blockSlots + 1) * sizeof(*s->starts));
+    s->blocks = calloc(s->blockSlots, sizeof(*s->blocks));
+    if (!s->path || !s->temporary || !s->prior || !s->work || !s->offsets || !s->adlers || !s->buffer || !s->starts ||
+        !s->blocks) {
+        pngStreamFree(s);
+        return -1;
+    }
+    s->scratch[0] = s->work;
+    s->scratch[1] = s->work + s->rowBytes;
+    strcpy(s->path, path);
+    sprintf(s->temporary, "%s.tmp", path);
+
+    s->file = fopen(s->temporary, "wb");
+    if (!s->file || (s->written = pngWriteHead(s->file, width, height, channels, palette)) == 0) {
+        pngStreamFree(s);
+        return -1;
+    }
+
+    // placeholder for the index, see pngStreamClose
+    if (s->segmentCount > 1) {
+        size_t length;
+        unsigned char *index = pngIndexData(s->segmentCount, s->segmentRows, NULL, NULL, &length);
+        if (!index || pngWriteChunk(s->file, "stIX", index, length, 0) != 0) {
+            free(index);
+            pngStreamFree(s);
+            return -1;
+        }
+        free(index);
+        s->indexOffset = s->written;
+        s->written += 12 + length;
+    }
+    return 0;
+}
+
+// The first filter hint and every PNG_HINT_CHECK-th after it are
+// checked against the full choice; a hint scoring more than 1/8
+// worse than the best filter means the input's filters don't suit
+// this image (e.g. an encoder that never filters), and the stream
+// stops taking hints
+#define PNG_HINT_CHECK 16
+
+// ------------------------------------------------------------
+// Function: pngStreamRow
+// Purpose : Filters one row (rowBytes as given to pngStreamOpen) into
+//           the stream
+// Method  : filter >= 0 is used as it is (e.g. the filter the row had
+//           in the input file) instead of trying all five, as long as
+//           the row may use it and the checks above keep passing;
+//           -1 = pick the best one
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int pngStreamRow(struct pngStream *s, const unsigned char *row, int filter) {
+    int y = s->row++;
+    int segmentStart = y == s->segmentRows[s->segmentsDone + s->pending];
+
+    if (atomic_load(&s->failed)) return -1;
+    if (segmentStart) {
+        if (s->pending == s->blockSlots && pngStreamFlush(s, 0) != 0) return -1;
+        s->starts[s->pending++] = s->filled;
+    }
+
+    unsigned char *out = s->buffer + s->filled;
+    int last = pngLastFilter(s->indexed, segmentStart);
+    int hinted = filter >= PNG_FILTER_NONE && filter <= last && !s->hintsOff;
+    if (hinted && s->hints++ % PNG_HINT_CHECK != 0) {
+        out[0] = (unsigned char)filter;
+        pngFilterRow(out + 1, row, s->prior, s->rowBytes, s->bpp, filter);
+    } else {
+        int best = pngFilterBest(row, s->prior, s->rowBytes, s->bpp, last, out, s->scratch);
+        if (hinted && best != filter) {
+            pngFilterRow(s->scratch[1], row, s->prior, s->rowBytes, s->bpp, filter);
+            uint64_t bestScore = kernels.pngScore(out + 1, s->rowBytes);
+            if (kernels.pngScore(s->scratch[1], s->rowBytes) > bestScore + bestScore / 8) s->hintsOff = 1;
+        }
+    }
+    memcpy(s->prior, row, s->rowBytes);
+    s->filled += s->rowBytes + 1;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: pngStreamCopy
+// Purpose : Takes the next segment as it is from another file of
+//           ours with the same segments: its IDAT chunk at `offset`
+//           in `in` is copied unchanged (only the zlib trailer in
+//           the last segment is replaced), `adler` is the segment's
+//           Adler-32 from that file's index
+// Method  : Has to be called at the first row of a segment; the
+//           pending segments are written first
+// Returns : 0 on success, -1 on error
+// ------------------------------------------------------------
+int pngStreamCopy(struct pngStream *s, FILE *in, uint64_t offset, uint32_t adler) {
+    int k = s->segmentsDone + s->pending;
+    if (atomic_load(&s->failed) || k >= s->segmentCount || s->row != s->segmentRows[k]) return -1;
+    if (s->pending > 0 && pngStreamFlush(s, 0) != 0) return -1;
+
+    int last = k == s->segmentCount - 1;
+    unsigned char header[8];
+    unsigned char *buffer = malloc(PNG_READ_CHUNK);
+    atomic_store(&s->failed, !buffer || offset > (uint64_t)LONG_MAX || fseek(in, (long)offset, SEEK_SET) != 0 ||
+                             fread(header, 1, 8, in) != 8 || memcmp(header + 4, "IDAT", 4) != 0 ||
+                             (last && pngGetU32(header) < 4) || fwrite(header, 1, 8, s->file) != 8);
+
+    // the data (+ CRC) as it is; the last chunk gets the new trailer and CRC
+    uint32_t length = pngGetU32(header);
+    uint64_t left = last ? length - 4 : (uint64_t)length + 4;
+    uint32_t crc = pngCrc(0, header + 4, 4);
+    while (left > 0 && !atomic_load(&s->failed)) {
+        size_t n = left < PNG_READ_CHUNK ? (size_t)left : PNG_READ_CHUNK;
+        atomic_store(&s->failed, fread(buffer, 1, n, in) != n || fwrite(buffer, 1, n, s->file) != n);
+        if (last) crc = pngCrc(crc, buffer, n);
+        left -= n;
+    }
+    free(buffer);
+
+    size_t bytes = (size_t)(s->segmentRows[k + 1] - s->segmentRows[k]) * (s->rowBytes + 1);
+    s->adler = adler32Combine(s->adler, adler, bytes);
+    if (last && !atomic_load(&s->failed)) {
+        unsigned char trailer[8];
+        pngPutU32(trailer, s->adler);
+        pngPutU32(trailer + 4, pngCrc(crc, trailer, 4));
+        atomic_store(&s->failed, fwrite(trailer, 1, 8, s->file) != 8);
+    }
+    if (atomic_load(&s->failed)) return -1;
+
+    s->adlers[k] = adler;
+    s->offsets[k] = s->written;
+    s->written += 12 + (uint64_t)length;
+    s->segmentsDone++;
+    s->row = s->segmentRows[k + 1];
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Function: pngStreamClose
+// Purpose : Writes the remaining segments, the index and IEND, and
+//           moves the file to its final name; frees the stream
+// Returns : 0 on success, -1 on error (no output file is left then)
+// ------------------------------------------------------------
+int pngStreamClose(struct pngStream *s) {
+    int result = atomic_load(&s->failed) ? -1 : pngStreamFlush(s, 1);
+    if (result == 0) result = pngWriteChunk(s->file, "IEND", NULL, 0, pngChunkCrc("IEND", NULL, 0));
+
+    if (result == 0 && s->indexOffset > 0) {
+        size_t length;
+        unsigned char *index = pngIndexData(s->segmentCount, s->segmentRows, s->offsets, s->adlers, &length);
+        if (!index || fseek(s->file, (long)s->indexOffset, SEEK_SET) != 0 ||
+            pngWriteChunk(s->file, "stIX", index, length, pngChunkCrc("stIX", index, length)) != 0) {
+            result = -1;
+        }
+        free(index);
+    }
+    if (fclose(s->file) != 0) result = -1;
+    s->file = NULL;
+
+#ifdef _WIN32
+    if (result == 0) remove(s->path); // rename doesn't replace files there
+#endif
+    if (result != 0 || rename(s->temporary, s->path) != 0) {
+        remove(s->temporary);
+        result = -1;
+    }
+    pngStreamFree(s);
+    return result;
+}
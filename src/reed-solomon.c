@@ -0,0 +1,287 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// Reed-Solomon over GF(256)
+// Field polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), generator 2,
+// code roots 2^0 .. 2^(nsym-1). Codeword byte 0 is the coefficient
+// of the highest power; the nsym parity bytes come last.
+//
+// The payload code (see "Payload error correction" in engine.c)
+// interleaves its codewords: byte j of every codeword is stored in
+// row j, so one kernel call encodes a whole block of codewords side
+// by side, with products by the generator coefficients looked up in
+// split nibble tables (c * low nibble, c * high nibble) by pshufb.
+// Decoding runs the same encoder: received parity XOR recomputed
+// parity is the remainder of the codeword, zero for an intact one.
+// Only the others get syndromes and the scalar decoder
+// (Berlekamp-Massey, Chien search, Forney).
+// ------------------------------------------------------------
+#define RS_MAX_PARITY 128
+
+static unsigned char gfExp[512];
+static unsigned char gfLog[256];
+static int gfReady;
+
+static void gfInit(void) {
+    if (gfReady) return;
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gfExp[i] = (unsigned char)x;
+        gfLog[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100) x ^= 0x11D;
+    }
+    for (int i = 255; i < 512; i++) gfExp[i] = gfExp[i - 255];
+    gfReady = 1;
+}
+
+static inline unsigned char gfMul(unsigned char a, unsigned char b) {
+    return a && b ? gfExp[gfLog[a] + gfLog[b]] : 0;
+}
+
+static inline unsigned char gfDiv(unsigned char a, unsigned char b) {
+    return a ? gfExp[gfLog[a] + 255 - gfLog[b]] : 0;
+}
+
+// Split nibble table of the constant c: c * x for x < 16, then c * (x << 4)
+static void gfTable(unsigned char c, unsigned char table[32]) {
+    for (int x = 0; x < 16; x++) {
+        table[x] = gfMul(c, (unsigned char)x);
+        table[16 + x] = gfMul(c, (unsigned char)(x << 4));
+    }
+}
+
+// Generator polynomial (x - 2^0)...(x - 2^(nsym-1)), highest power first, monic
+static void rsGenerator(int nsym, unsigned char *g) {
+    memset(g, 0, nsym + 1);
+    g[0] = 1;
+    for (int i = 0; i < nsym; i++) {
+        unsigned char root = gfExp[i];
+        for (int j = i + 1; j > 0; j--) g[j] ^= gfMul(g[j - 1], root);
+    }
+}
+
+// ------------------------------------------------------------
+// Encoder kernels
+// Computes the parity of `width` codewords at once: codeword i is
+// byte i of each of the `rows` data rows (stride apart), parity row m
+// goes to parity + m * parityStride. tables[m] is the split nibble
+// table of generator coefficient m + 1.
+//
+// The parity bytes are the registers of the usual shift register
+// encoder (feedback = data ^ parity[0], parity[m] = parity[m + 1] ^
+// g[m + 1] * feedback). They live in a ring, so a row costs one
+// nibble split of the feedback and then two table lookups and an XOR
+// per parity byte, in place, for 16 / 32 / 64 codewords at a time.
+// ------------------------------------------------------------
+typedef void (*rsEncodeFn)(const unsigned char (*tables)[32], int nsym, const unsigned char *data, size_t stride,
+                           size_t rows, unsigned char *parity, size_t parityStride, size_t width);
+
+static void rsEncodeScalar(const unsigned char (*tables)[32], int nsym, const unsigned char *data, size_t stride,
+                           size_t rows, unsigned char *parity, size_t parityStride, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        unsigned char ring[RS_MAX_PARITY] = { 0 };
+        int base = 0;
+        for (size_t j = 0; j < rows; j++) {
+            unsigned char feedback = data[j * stride + i] ^ ring[base];
+            int low = feedback & 15, high = 16 + (feedback >> 4);
+
+            // coefficients 1 .. nsym in order: ring slots base + 1 .. nsym - 1, 0 .. base - 1, base
+            const unsigned char *t = tables[0];
+            for (int at = base + 1; at < nsym; at++, t += 32) ring[at] ^= t[low] ^ t[high];
+            for (int at = 0; at < base; at++, t += 32) ring[at] ^= t[low] ^ t[high];
+            ring[base] = t[low] ^ t[high];
+            base = base + 1 < nsym ? base + 1 : 0;
+        }
+        for (int m = 0; m < nsym; m++) parity[m * parityStride + i] = ring[base + m < nsym ? base + m : base + m - nsym];
+    }
+}
+
+#ifdef CPU_X86
+// The rows are far apart, so the hardware prefetcher doesn't follow them
+#define RS_PREFETCH 256
+
+__attribute__((target("ssse3")))
+static inline __m128i rsProductSsse3(const unsigned char *t, __m128i low, __m128i high) {
+    return _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)t), low),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(t + 16)), high));
+}
+
+__attribute__((target("ssse3")))
+static void rsEncodeSsse3(const unsigned char (*tables)[32], int nsym, const unsigned char *data, size_t stride,
+                          size_t rows, unsigned char *parity, size_t parityStride, size_t width) {
+    const __m128i nibble = _mm_set1_epi8(15);
+    __m128i ring[RS_MAX_PARITY];
+    size_t i = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        int base = 0;
+        for (int m = 0; m < nsym; m++) ring[m] = _mm_setzero_si128();
+        for (size_t j = 0; j < rows; j++) {
+            _mm_prefetch((const char *)(data + j * stride + i + RS_PREFETCH), _MM_HINT_T0);
+            __m128i feedback = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + j * stride + i)), ring[base]);
+            __m128i low = _mm_and_si128(feedback, nibble);
+            __m128i high = _mm_and_si128(_mm_srli_epi64(feedback, 4), nibble);
+
+            const unsigned char *t = tables[0];
+            for (int at = base + 1; at < nsym; at++, t += 32) ring[at] = _mm_xor_si128(ring[at], rsProductSsse3(t, low, high));
+            for (int at = 0; at < base; at++, t += 32) ring[at] = _mm_xor_si128(ring[at], rsProductSsse3(t, low, high));
+            ring[base] = rsProductSsse3(t, low, high);
+            base = base + 1 < nsym ? base + 1 : 0;
+        }
+        for (int m = 0; m < nsym; m++) {
+            _mm_storeu_si128((__m128i *)(parity + m * parityStride + i), ring[base + m < nsym ? base + m : base + m - nsym]);
+        }
+    }
+    rsEncodeScalar(tables, nsym, data + i, stride, rows, parity + i, parityStride, width - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rsProductAvx2(const unsigned char *t, __m256i low, __m256i high) {
+    return _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t)), low),
+                            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t + 16))), high));
+}
+
+__attribute__((target("avx2")))
+static void rsEncodeAvx2(const unsigned char (*tables)[32], int nsym, const unsigned char *data, size_t stride,
+                         size_t rows, unsigned char *parity, size_t parityStride, size_t width) {
+    const __m256i nibble = _mm256_set1_epi8(15);
+    __m256i ring[RS_MAX_PARITY];
+    size_t i = 0;
+
+    for (; i + 32 <= width; i += 32) {
+        int base = 0;
+        for (int m = 0; m < nsym; m++) ring[m] = _mm256_setzero_si256();
+        for (size_t j = 0; j < rows; j++) {
+            _mm_prefetch((const char *)(data + j * stride + i + RS_PREFETCH), _MM_HINT_T0);
+            __m256i feedback = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(data + j * stride + i)), ring[base]);
+            __m256i low = _mm256_and_si256(feedback, nibble);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi64(feedback, 4), nibble);
+
+            const unsigned char *t = tables[0];
+            for (int at = base + 1; at < nsym; at++, t += 32) ring[at] = _mm256_xor_si256(ring[at], rsProductAvx2(t, low, high));
+            for (int at = 0; at < base; at++, t += 32) ring[at] = _mm256_xor_si256(ring[at], rsProductAvx2(t, low, high));
+            ring[base] = rsProductAvx2(t, low, high);
+            base = base + 1 < nsym ? base + 1 : 0;
+        }
+        for (int m = 0; m < nsym; m++) {
+            _mm256_storeu_si256((__m256i *)(parity + m * parityStride + i), ring[base + m < nsym ? base + m : base + m - nsym]);
+        }
+    }
+    rsEncodeScalar(tables, nsym, data + i, stride, rows, parity + i, parityStride, width - i);
+}
+
+__attribute__((target("avx512bw")))
+static inline __m512i rsProductAvx512(const unsigned char *t, __m512i low, __m512i high) {
+    return _mm512_xor_si512(_mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)t)), low),
+                            _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)(t + 16))), high));
+}
+
+__attribute__((target("avx512bw,bmi2")))
+static void rsEncodeAvx512(const unsigned char (*tables)[32], int nsym, const unsigned char *data, size_t stride,
+                           size_t rows, unsigned char *parity, size_t parityStride, size_t width) {
+    const __m512i nibble = _mm512_set1_epi8(15);
+    __m512i ring[RS_MAX_PARITY];
+
+    for (size_t i = 0; i < width; i += 64) {
+        __mmask64 mask = width - i >= 64 ? ~0ULL : _bzhi_u64(~0ULL, (unsigned)(width - i));
+        int base = 0;
+        for (int m = 0; m < nsym; m++) ring[m] = _mm512_setzero_si512();
+        for (size_t j = 0; j < rows; j++) {
+            _mm_prefetch((const char *)(data + j * stride + i + RS_PREFETCH), _MM_HINT_T0);
+            __m512i feedback = _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, data + j * stride + i), ring[base]);
+            __m512i low = _mm512_and_si512(feedback, nibble);
+            __m512i high = _mm512_and_si512(_mm512_srli_epi64(feedback, 4), nibble);
+
+            const unsigned char *t = tables[0];
+            for (int at = base + 1; at < nsym; at++, t += 32) ring[at] = _mm512_xor_si512(ring[at], rsProductAvx512(t, low, high));
+            for (int at = 0; at < base; at++, t += 32) ring[at] = _mm512_xor_si512(ring[at], rsProductAvx512(t, low, high));
+            ring[base] = rsProductAvx512(t, low, high);
+            base = base + 1 < nsym ? base + 1 : 0;
+        }
+        for (int m = 0; m < nsym; m++) {
+            _mm512_mask_storeu_epi8(parity + m * parityStride + i, mask, ring[base + m < nsym ? base + m : base + m - nsym]);
+        }
+    }
+}
+#endif
+
+// Evaluates poly (lowest power first, `count` terms) at x
+static unsigned char rsEvaluate(const unsigned char *poly, int count, unsigned char x) {
+    unsigned char y = 0;
+    for (int i = count - 1; i >= 0; i--) y = gfMul(y, x) ^ poly[i];
+    return y;
+}
+
+// Syndromes from the remainder (received mod generator, highest power
+// first): the generator vanishes at the roots, so they are the same
+static void rsSyndromes(const unsigned char *remainder, int nsym, unsigned char *syndromes) {
+    for (int r = 0; r < nsym; r++) {
+        unsigned char y = 0;
+        for (int m = 0; m < nsym; m++) y = gfMul(y, gfExp[r]) ^ remainder[m];
+        syndromes[r] = y;
+    }
+}
+
+// ------------------------------------------------------------
+// Function: rsCorrect
+// Purpose : Corrects one codeword of n bytes (n <= 255) in place,
+//           given its syndromes (syndromes[r] = codeword at 2^r)
+// Method  : Berlekamp-Massey for the error locator, Chien search
+//           for its roots, Forney for the error values
+// Returns : number of corrected bytes, -1 if there are more errors
+//           than nsym / 2
+// ------------------------------------------------------------
+int rsCorrect(unsigned char *codeword, int n, int nsym, const unsigned char *syndromes) {
+    unsigned char locator[RS_MAX_PARITY + 1] = { 1 }, previous[RS_MAX_PARITY + 1] = { 1 };
+    unsigned char saved[RS_MAX_PARITY + 1];
+    int length = 0, shift = 1;
+    unsigned char lastDiscrepancy = 1;
+
+    // locator polynomials lowest power first
+    for (int r = 0; r < nsym; r++) {
+        unsigned char d = syndromes[r];
+        for (int i = 1; i <= length; i++) d ^= gfMul(locator[i], syndromes[r - i]);
+        if (d == 0) {
+            shift++;
+            continue;
+        }
+
+        unsigned char scale = gfDiv(d, lastDiscrepancy);
+        memcpy(saved, locator, sizeof(saved));
+        for (int i = 0; i + shift <= RS_MAX_PARITY; i++) locator[i + shift] ^= gfMul(scale, previous[i]);
+        if (2 * length <= r) {
+            length = r + 1 - length;
+            memcpy(previous, saved, sizeof(previous));
+            lastDiscrepancy = d;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (2 * length > nsym) return -1;
+
+    // error evaluator: syndromes * locator mod x^nsym
+    unsigned char evaluator[RS_MAX_PARITY] = { 0 };
+    for (int i = 0; i < nsym; i++) {
+        for (int j = 0; j <= i && j <= length; j++) evaluator[i] ^= gfMul(syndromes[i - j], locator[j]);
+    }
+
+    // byte p holds the power k = n - 1 - p; it is wrong if locator(2^-k) == 0
+    int found = 0;
+    for (int k = 0; k < n && found <= length; k++) {
+        unsigned char inverse = gfExp[(255 - k) % 255];
+        if (rsEvaluate(locator, length + 1, inverse) != 0) continue;
+
+        // Forney (first root 2^0): e = X * evaluator(1/X) / locator'(1/X)
+        unsigned char derivative = 0;
+        for (int i = 1; i <= length; i += 2) derivative ^= gfMul(locator[i], gfExp[(gfLog[inverse] * (i - 1)) % 255]);
+        if (derivative == 0) return -1;
+        unsigned char value = gfDiv(gfMul(gfExp[k], rsEvaluate(evaluator, nsym, inverse)), derivative);
+        codeword[n - 1 - k] ^= value;
+        found++;
+    }
+    return found == length ? found : -1;
+}
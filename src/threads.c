@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define THREADS_PTHREAD 1
+#endif
+
+// ------------------------------------------------------------
+// Worker threads
+// The engine splits large jobs into independent parts (row bands,
+// byte ranges) and runs them through parallelRun(). How many threads
+// may be used is set once from the --threads option; without it
+// everything runs on the calling thread, exactly as before.
+// ------------------------------------------------------------
+#define THREADS_MAX 256
+
+typedef void (*parallelFn)(void *ctx, int index, int count);
+
+static int threadCount = 1;
+static _Thread_local int parallelWorker; // set while running a part: nested runs stay serial
+
+// Number of online CPUs (1 if unknown)
+int threadsAvailable(void) {
+#ifdef THREADS_PTHREAD
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long n = (long)info.dwNumberOfProcessors;
+#endif
+    if (n > THREADS_MAX) return THREADS_MAX;
+    return n > 0 ? (int)n : 1;
+}
+
+// ------------------------------------------------------------
+// Function: threadsSet
+// Purpose : Applies a --threads value: a count, or "auto" / 0 for
+//           one thread per CPU
+// Returns : 0 on success, -1 (after printing why) otherwise
+// ------------------------------------------------------------
+int threadsSet(const char *value) {
+    char *end;
+    long n = strcmp(value, "auto") == 0 ? 0 : strtol(value, &end, 10);
+
+    if (strcmp(value, "auto") != 0 && (*value == '\0' || *end != '\0' || n < 0 || n > THREADS_MAX)) {
+        printf("Invalid thread count \"%s\" (use 1..%d or auto).\n", value, THREADS_MAX);
+        return -1;
+    }
+
+    threadCount = n == 0 ? threadsAvailable() : (int)n;
+    return 0;
+}
+
+// Number of parts worth splitting `work` units into, at least `minPart` units each
+int threadsFor(size_t work, size_t minPart) {
+    size_t parts = minPart > 0 ? work / minPart : work;
+    if (parts < 1) return 1;
+    return parts < (size_t)threadCount ? (int)parts : threadCount;
+}
+
+struct parallelTask {
+    parallelFn fn;
+    void *ctx;
+    int index, count;
+};
+
+#ifdef THREADS_PTHREAD
+typedef pthread_t threadId;
+
+static void *parallelEntry(void *arg) {
+    struct parallelTask *task = arg;
+    parallelWorker = 1;
+    task->fn(task->ctx, task->index, task->count);
+    return NULL;
+}
+
+static int threadStart(threadId *id, struct parallelTask *task) {
+    return pthread_create(id, NULL, parallelEntry, task) == 0;
+}
+
+static void threadJoin(threadId id) {
+    pthread_join(id, NULL);
+}
+#else
+typedef HANDLE threadId;
+
+static DWORD WINAPI parallelEntry(LPVOID arg) {
+    struct parallelTask *task = arg;
+    parallelWorker = 1;
+    task->fn(task->ctx, task->index, task->count);
+    return 0;
+}
+
+static int threadStart(threadId *id, struct parallelTask *task) {
+    *id = CreateThread(NULL, 0, parallelEntry, task, 0, NULL);
+    return *id != NULL;
+}
+
+static void threadJoin(threadId id) {
+    WaitForSingleObject(id, INFINITE);
+    CloseHandle(id);
+}
+#endif
+
+// ------------------------------------------------------------
+// Function: parallelRun
+// Purpose : Calls fn(ctx, i, count) for every i < count, each on its
+//           own thread (part 0 on the caller), and waits for all
+// Method  : If a thread can't be started its part runs on the
+//           caller, so the work always gets done. Calls from inside
+//           a part run serially instead of starting more threads.
+// ------------------------------------------------------------
+void parallelRun(int count, parallelFn fn, void *ctx) {
+    if (count > 1 && !parallelWorker) {
+        threadId ids[THREADS_MAX];
+        struct parallelTask tasks[THREADS_MAX];
+        int started[THREADS_MAX] = { 0 };
+
+        if (count > THREADS_MAX) count = THREADS_MAX;
+        for (int i = 1; i < count; i++) {
+            tasks[i] = (struct parallelTask){ fn, ctx, i, count };
+            started[i] = threadStart(&ids[i], &tasks[i]);
+        }
+
+        parallelWorker = 1;
+        fn(ctx, 0, count);
+        parallelWorker = 0;
+        for (int i = 1; i < count; i++) {
+            if (started[i]) threadJoin(ids[i]);
+            else fn(ctx, i, count);
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) fn(ctx, i, count);
+}
+
+// Monotonic clock in seconds (for benchmarks)
+double timeNow(void) {
+#ifdef THREADS_PTHREAD
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + t.tv_nsec * 1e-9;
+#else
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#endif
+}
+
+struct parallelCopyJob {
+    unsigned char *target;
+    const unsigned char *source;
+    size_t size;
+};
+
+static void parallelCopyPart(void *ctx, int index, int count) {
+    struct parallelCopyJob *job = ctx;
+    size_t begin = job->size / count * index;
+    size_t end = index == count - 1 ? job->size : job->size / count * (index + 1);
+    memcpy(job->target + begin, job->source + begin, end - begin);
+}
+
+// memcpy split over the worker threads (for copying whole covers)
+void parallelCopy(void *target, const void *source, size_t size) {
+    struct parallelCopyJob job = { target, source, size };
+    parallelRun(threadsFor(size, 4 << 20), parallelCopyPart, &job);
+}
@@ -0,0 +1,893 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------------------------------------------
+// zlib / deflate support
+// stb_image can only inflate a complete buffer in one go. For
+// reading PNGs row by row (and stopping early) we need an
+// inflater that hands out the decompressed bytes on demand, so
+// this file implements RFC 1950 / 1951 decoding as a pull stream.
+// ------------------------------------------------------------
+
+// ------------------------------------------------------------
+// Adler-32 checksum (zlib trailer)
+// ------------------------------------------------------------
+#define ADLER_MOD 65521
+
+uint32_t adler32(uint32_t adler, const unsigned char *data, size_t length) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+    while (length > 0) {
+        // 5552 is the largest block for which b can't overflow 32 bits
+        size_t block = length < 5552 ? length : 5552;
+        length -= block;
+        while (block--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+// ------------------------------------------------------------
+// Huffman decoding tables
+// Codes up to ZFAST_BITS long are resolved with one table lookup,
+// longer ones bit by bit over the canonical code (rare).
+// ------------------------------------------------------------
+#define ZFAST_BITS 10
+#define ZFAST_MASK ((1 << ZFAST_BITS) - 1)
+
+struct zhuffman {
+    uint16_t fast[1 << ZFAST_BITS]; // (length << 9) | symbol, 0 = longer code
+    uint16_t count[16];             // number of codes per length
+    uint16_t symbol[288];           // symbols sorted by code
+};
+
+static int zhuffmanBuild(struct zhuffman *h, const unsigned char *lengths, int n) {
+    uint16_t offset[16];
+    int code = 0;
+
+    memset(h, 0, sizeof(*h));
+    for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+
+    // over-subscribed code sets are invalid
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return -1;
+    }
+
+    offset[1] = 0;
+    for (int len = 1; len < 15; len++) offset[len + 1] = offset[len] + h->count[len];
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) h->symbol[offset[lengths[i]]++] = (uint16_t)i;
+    }
+
+    // canonical codes, stored bit-reversed because deflate sends them MSB first
+    int index = 0;
+    for (int len = 1; len < 16; len++) {
+        for (int k = 0; k < h->count[len]; k++, code++, index++) {
+            if (len > ZFAST_BITS) continue;
+
+            int reversed = 0;
+            for (int b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+            for (int j = reversed; j < (1 << ZFAST_BITS); j += 1 << len) {
+                h->fast[j] = (uint16_t)((len << 9) | h->symbol[index]);
+            }
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Streaming inflater
+// Input is pulled through the refill callback whenever the bit
+// buffer runs low; output is produced by inflateRead() in
+// whatever portions the caller asks for. The last 32 KB of output
+// are kept as the back-reference window.
+// ------------------------------------------------------------
+#define ZWINDOW_SIZE 32768
+
+enum { ZS_HEADER, ZS_BLOCK, ZS_STORED, ZS_CODES, ZS_TRAILER, ZS_DONE, ZS_ERROR };
+
+// Returns the next piece of compressed input (0 = no more data)
+typedef size_t (*inflateRefillFn)(void *ctx, const unsigned char **data);
+
+struct inflater {
+    inflateRefillFn refill;
+    void *ctx;
+    const unsigned char *in;
+    size_t inLeft;
+    size_t overrun;        // zero bytes fed after the input ended
+    uint64_t bits;
+    int bitCount;
+
+    int state;
+    int raw;               // 1 = no zlib header / trailer around the data
+    int lastBlock;
+    size_t storedLeft;
+    int copyLength, copyDistance;
+    struct zhuffman literals, distances;
+
+    unsigned char window[ZWINDOW_SIZE];
+    size_t total;          // bytes produced so far
+    uint32_t adler;
+};
+
+static const uint16_t zLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t zLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t zDistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t zDistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// ------------------------------------------------------------
+// Function: inflateInit
+// Purpose : Prepares an inflater; raw = 1 for bare deflate data
+//           (e.g. a segment starting at a full-flush point)
+// ------------------------------------------------------------
+void inflateInit(struct inflater *z, inflateRefillFn refill, void *ctx, int raw) {
+    memset(z, 0, sizeof(*z));
+    z->refill = refill;
+    z->ctx = ctx;
+    z->raw = raw;
+    z->state = raw ? ZS_BLOCK : ZS_HEADER;
+    z->adler = 1;
+}
+
+static void zFill(struct inflater *z) {
+    while (z->bitCount <= 56) {
+        if (z->inLeft == 0) {
+            z->inLeft = z->refill(z->ctx, &z->in);
+            if (z->inLeft == 0) {
+                // feed zeros; consuming them is detected in zUsedOverrun()
+                z->overrun++;
+                z->bitCount += 8;
+                continue;
+            }
+        }
+        z->bits |= (uint64_t)*z->in++ << z->bitCount;
+        z->inLeft--;
+        z->bitCount += 8;
+    }
+}
+
+static inline int zUsedOverrun(const struct inflater *z) {
+    return z->overrun * 8 > (size_t)z->bitCount;
+}
+
+static inline uint32_t zBits(struct inflater *z, int n) {
+    if (z->bitCount < n) zFill(z);
+    uint32_t value = (uint32_t)(z->bits & ((1ULL << n) - 1));
+    z->bits >>= n;
+    z->bitCount -= n;
+    return value;
+}
+
+static int zDecode(struct inflater *z, const struct zhuffman *h) {
+    if (z->bitCount < 16) zFill(z);
+
+    uint16_t entry = h->fast[z->bits & ZFAST_MASK];
+    if (entry) {
+        int len = entry >> 9;
+        z->bits >>= len;
+        z->bitCount -= len;
+        return entry & 511;
+    }
+
+    // canonical decode, one bit at a time
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= (int)((z->bits >> (len - 1)) & 1);
+        int count = h->count[len];
+        if (code - first < count) {
+            z->bits >>= len;
+            z->bitCount -= len;
+            return h->symbol[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int zReadDynamicTables(struct inflater *z) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned char lengths[286 + 30];
+    unsigned char codeLengths[19] = { 0 };
+    struct zhuffman lengthCodes;
+
+    int nLiterals = zBits(z, 5) + 257;
+    int nDistances = zBits(z, 5) + 1;
+    int nCodes = zBits(z, 4) + 4;
+    if (nLiterals > 286 || nDistances > 30) return -1;
+
+    for (int i = 0; i < nCodes; i++) codeLengths[order[i]] = (unsigned char)zBits(z, 3);
+    if (zhuffmanBuild(&lengthCodes, codeLengths, 19) != 0) return -1;
+
+    int n = 0;
+    while (n < nLiterals + nDistances) {
+        int symbol = zDecode(z, &lengthCodes);
+        int repeat, value = 0;
+
+        if (symbol < 0) return -1;
+        if (symbol < 16) {
+            lengths[n++] = (unsigned char)symbol;
+            continue;
+        } else if (symbol == 16) {
+            if (n == 0) return -1;
+            value = lengths[n - 1];
+            repeat = 3 + zBits(z, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + zBits(z, 3);
+        } else {
+            repeat = 11 + zBits(z, 7);
+        }
+        if (n + repeat > nLiterals + nDistances) return -1;
+        memset(lengths + n, value, repeat);
+        n += repeat;
+    }
+    if (lengths[256] == 0) return -1;
+
+    if (zhuffmanBuild(&z->literals, lengths, nLiterals) != 0) return -1;
+    if (zhuffmanBuild(&z->distances, lengths + nLiterals, nDistances) != 0) return -1;
+    return 0;
+}
+
+static void zFixedTables(struct inflater *z) {
+    unsigned char lengths[288];
+
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    zhuffmanBuild(&z->literals, lengths, 288);
+
+    memset(lengths, 5, 30);
+    zhuffmanBuild(&z->distances, lengths, 30);
+}
+
+static inline void zPut(struct inflater *z, unsigned char byte, unsigned char *out) {
+    z->window[z->total & (ZWINDOW_SIZE - 1)] = byte;
+    z->total++;
+    *out = byte;
+}
+
+// Reads the next block header and switches the state accordingly
+static void zStartBlock(struct inflater *z) {
+    if (z->lastBlock) {
+        z->state = z->raw ? ZS_DONE : ZS_TRAILER;
+        return;
+    }
+
+    z->lastBlock = zBits(z, 1);
+    int type = zBits(z, 2);
+
+    if (type == 0) {
+        zBits(z, z->bitCount & 7); // align to the next byte
+        uint32_t length = zBits(z, 16);
+        uint32_t check = zBits(z, 16);
+        if ((length ^ 0xFFFF) != check) { z->state = ZS_ERROR; return; }
+        z->storedLeft = length;
+        z->state = ZS_STORED;
+    } else if (type == 1) {
+        zFixedTables(z);
+        z->state = ZS_CODES;
+    } else if (type == 2) {
+        z->state = zReadDynamicTables(z) == 0 ? ZS_CODES : ZS_ERROR;
+    } else {
+        z->state = ZS_ERROR;
+    }
+}
+
+// ------------------------------------------------------------
+// Function: inflateRead
+// Purpose : Produces up to `length` decompressed bytes
+// Returns : number of bytes written to out; fewer than asked for
+//           means the stream ended (state ZS_DONE) or is corrupt
+//           (state ZS_ERROR)
+// ------------------------------------------------------------
+size_t inflateRead(struct inflater *z, unsigned char *out, size_t length) {
+    size_t produced = 0;
+    size_t checked = 0; // bytes already added to the Adler-32 sum
+
+    while (produced < length) {
+        switch (z->state) {
+        case ZS_HEADER: {
+            uint32_t cmf = zBits(z, 8), flg = zBits(z, 8);
+            // deflate, window <= 32K, no preset dictionary, valid check bits
+            if ((cmf & 15) != 8 || (cmf >> 4) > 7 || (flg & 32) || ((cmf << 8) | flg) % 31 != 0) {
+                z->state = ZS_ERROR;
+            } else {
+                z->state = ZS_BLOCK;
+            }
+            break;
+        }
+
+        case ZS_BLOCK:
+            zStartBlock(z);
+            break;
+
+        case ZS_STORED: {
+            if (z->storedLeft == 0) {
+                z->state = ZS_BLOCK;
+                break;
+            }
+            // bytes still sitting in the bit buffer first, then straight from the input
+            if (z->bitCount >= 8) {
+                zPut(z, (unsigned char)zBits(z, 8), out + produced++);
+                z->storedLeft--;
+                break;
+            }
+            if (z->inLeft == 0 && (z->inLeft = z->refill(z->ctx, &z->in)) == 0) {
+                z->state = ZS_ERROR;
+                break;
+            }
+            size_t n = z->inLeft;
+            if (n > z->storedLeft) n = z->storedLeft;
+            if (n > length - produced) n = length - produced;
+            for (size_t i = 0; i < n; i++) zPut(z, z->in[i], out + produced++);
+            z->in += n;
+            z->inLeft -= n;
+            z->storedLeft -= n;
+            break;
+        }
+
+        case ZS_CODES:
+            if (z->copyLength > 0) {
+                // pending back reference
+                size_t from = z->total - z->copyDistance;
+                while (z->copyLength > 0 && produced < length) {
+                    zPut(z, z->window[from++ & (ZWINDOW_SIZE - 1)], out + produced++);
+                    z->copyLength--;
+                }
+                break;
+            }
+
+            int symbol = zDecode(z, &z->literals);
+            if (symbol < 0 || zUsedOverrun(z)) {
+                z->state = ZS_ERROR;
+            } else if (symbol < 256) {
+                zPut(z, (unsigned char)symbol, out + produced++);
+            } else if (symbol == 256) {
+                z->state = ZS_BLOCK;
+            } else {
+                symbol -= 257;
+                if (symbol >= 29) { z->state = ZS_ERROR; break; }
+                z->copyLength = zLengthBase[symbol] + zBits(z, zLengthExtra[symbol]);
+
+                int d = zDecode(z, &z->distances);
+                if (d < 0 || d >= 30) { z->state = ZS_ERROR; break; }
+                z->copyDistance = zDistBase[d] + zBits(z, zDistExtra[d]);
+                if ((size_t)z->copyDistance > z->total) z->state = ZS_ERROR;
+            }
+            break;
+
+        case ZS_TRAILER: {
+            z->adler = adler32(z->adler, out + checked, produced - checked);
+            checked = produced;
+
+            zBits(z, z->bitCount & 7);
+            uint32_t expected = 0;
+            for (int i = 0; i < 4; i++) expected = (expected << 8) | zBits(z, 8);
+            z->state = (expected == z->adler && !zUsedOverrun(z)) ? ZS_DONE : ZS_ERROR;
+            break;
+        }
+
+        default: // ZS_DONE, ZS_ERROR
+            z->adler = adler32(z->adler, out + checked, produced - checked);
+            return produced;
+        }
+    }
+
+    if (zUsedOverrun(z)) z->state = ZS_ERROR;
+    z->adler = adler32(z->adler, out + checked, produced - checked);
+    return produced;
+}
+
+// Combines the Adler-32 sums of two adjacent pieces (len2 = length of the second)
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+    uint32_t rem = (uint32_t)(len2 % ADLER_MOD);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (rem * sum1) % ADLER_MOD;
+
+    sum1 += (adler2 & 0xFFFF) + ADLER_MOD - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_MOD - rem;
+    if (sum1 >= ADLER_MOD) sum1 -= ADLER_MOD;
+    if (sum1 >= ADLER_MOD) sum1 -= ADLER_MOD;
+    if (sum2 >= 2 * ADLER_MOD) sum2 -= 2 * ADLER_MOD;
+    if (sum2 >= ADLER_MOD) sum2 -= ADLER_MOD;
+    return (sum2 << 16) | sum1;
+}
+
+// ------------------------------------------------------------
+// Deflate compressor
+// Compresses one range of a buffer into raw deflate blocks. The
+// 32 KB in front of the range serve as history (matches may reach
+// back into them), so a large buffer can be cut into ranges that
+// are compressed independently and still match across the cuts.
+// A range either ends the stream (final block) or with a sync
+// flush, which leaves the output byte aligned: the compressed
+// ranges simply concatenate into one valid deflate stream.
+//
+// Matches come from hash chains with lazy evaluation; each block is
+// written with dynamic, fixed or no Huffman coding, whichever is
+// smallest.
+// ------------------------------------------------------------
+#define ZMIN_MATCH 3
+#define ZMAX_MATCH 258
+#define ZHASH_BITS 15
+#define ZBLOCK_TOKENS (1 << 14)
+
+// Growing output buffer with an LSB-first bit writer
+struct zwriter {
+    unsigned char *data;
+    size_t size, capacity;
+    uint64_t bits;
+    int bitCount;
+    int failed; // out of memory
+};
+
+static void zwByte(struct zwriter *w, unsigned char byte) {
+    if (w->size == w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 1 << 16;
+        unsigned char *bigger = realloc(w->data, capacity);
+        if (!bigger) {
+            w->failed = 1;
+            return;
+        }
+        w->data = bigger;
+        w->capacity = capacity;
+    }
+    w->data[w->size++] = byte;
+}
+
+static inline void zwBits(struct zwriter *w, uint32_t value, int n) {
+    w->bits |= (uint64_t)value << w->bitCount;
+    w->bitCount += n;
+    while (w->bitCount >= 8) {
+        zwByte(w, (unsigned char)w->bits);
+        w->bits >>= 8;
+        w->bitCount -= 8;
+    }
+}
+
+// Pads with zero bits to the next byte boundary
+static void zwAlign(struct zwriter *w) {
+    if (w->bitCount > 0) zwBits(w, 0, 8 - w->bitCount);
+}
+
+void zwFree(struct zwriter *w) {
+    free(w->data);
+    memset(w, 0, sizeof(*w));
+}
+
+// Compression levels: hash chain length, lazy match limit, "good enough" length
+static const struct { int chain, lazy, nice; } zLevels[10] = {
+    { 0, 0, 0 },        // 0: literals only
+    { 4, 0, 16 },   { 8, 0, 32 },     { 16, 0, 64 },
+    { 16, 8, 64 },  { 32, 16, 128 },  { 64, 32, 128 },
+    { 128, 64, 258 }, { 256, 128, 258 }, { 1024, 258, 258 },
+};
+
+struct ztoken {
+    uint16_t length;   // literal byte if distance == 0
+    uint16_t distance;
+};
+
+struct zmatcher {
+    const unsigned char *data;
+    size_t base;       // first position of the history
+    size_t end;        // end of the range being compressed
+    size_t hashed;     // positions below this are in the chains
+    size_t hashLimit;  // positions from here on can't be hashed (< 3 bytes left)
+    int chain, nice;
+    int32_t *head;     // newest position + 1 per hash, relative to base
+    int32_t *prev;
+};
+
+static inline uint32_t zHash(const unsigned char *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - ZHASH_BITS);
+}
+
+static void zInsertUpTo(struct zmatcher *m, size_t limit) {
+    if (limit > m->hashLimit) limit = m->hashLimit;
+    for (; m->hashed < limit; m->hashed++) {
+        uint32_t h = zHash(m->data + m->hashed);
+        m->prev[m->hashed - m->base] = m->head[h];
+        m->head[h] = (int32_t)(m->hashed - m->base + 1);
+    }
+}
+
+static inline size_t zMatchLength(const unsigned char *a, const unsigned char *b, size_t max) {
+    size_t n = 0;
+    while (n + 8 <= max) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) return n + (__builtin_ctzll(x ^ y) >> 3);
+        n += 8;
+    }
+    while (n < max && a[n] == b[n]) n++;
+    return n;
+}
+
+// Longest match for the bytes at pos (length < ZMIN_MATCH = none)
+static int zFindMatch(struct zmatcher *m, size_t pos, int *distance) {
+    if (pos + ZMIN_MATCH > m->end || pos >= m->hashLimit) return 0;
+    zInsertUpTo(m, pos);
+
+    size_t max = m->end - pos < ZMAX_MATCH ? m->end - pos : ZMAX_MATCH;
+    const unsigned char *p = m->data + pos;
+    int best = ZMIN_MATCH - 1;
+    int chain = m->chain;
+
+    for (int32_t c = m->head[zHash(p)]; c != 0 && chain-- > 0; c = m->prev[c - 1]) {
+        size_t candidate = m->base + (size_t)c - 1;
+        if (pos - candidate > ZWINDOW_SIZE) break;
+
+        const unsigned char *q = m->data + candidate;
+        if (q[best] != p[best] || q[0] != p[0]) continue;
+
+        int length = (int)zMatchLength(q, p, max);
+        if (length > best) {
+            best = length;
+            *distance = (int)(pos - candidate);
+            if (length >= m->nice || (size_t)length == max) break;
+        }
+    }
+    return best >= ZMIN_MATCH ? best : 0;
+}
+
+static int zLengthCode(int length) {
+    int code = 0;
+    while (code < 28 && zLengthBase[code + 1] <= length) code++;
+    return code;
+}
+
+static int zDistCode(int distance) {
+    int code = 0;
+    while (code < 29 && zDistBase[code + 1] <= distance) code++;
+    return code;
+}
+
+// ------------------------------------------------------------
+// Function: zHuffmanLengths
+// Purpose : Computes Huffman code lengths (at most `limit` bits)
+//           for the given symbol frequencies
+// Method  : Plain Huffman tree; if it gets too deep the frequencies
+//           are flattened and the tree is built again
+// ------------------------------------------------------------
+static void zHuffmanLengths(const uint32_t *frequencies, int n, int limit, unsigned char *lengths) {
+    uint32_t weight[2 * 288];
+    int parent[2 * 288], symbols[288];
+    int used = 0;
+
+    memset(lengths, 0, n);
+    for (int i = 0; i < n; i++) {
+        if (frequencies[i]) symbols[used++] = i;
+    }
+    if (used == 0) return;
+    if (used == 1) {
+        lengths[symbols[0]] = 1;
+        return;
+    }
+
+    for (int i = 0; i < used; i++) weight[i] = frequencies[symbols[i]];
+
+    for (;;) {
+        int nodes = used;
+        int active[2 * 288], activeCount = used;
+        for (int i = 0; i < used; i++) active[i] = i;
+
+        // join the two lightest nodes until one is left
+        while (activeCount > 1) {
+            int a = 0, b = 1;
+            if (weight[active[b]] < weight[active[a]]) { a = 1; b = 0; }
+            for (int i = 2; i < activeCount; i++) {
+                if (weight[active[i]] < weight[active[a]]) { b = a; a = i; }
+                else if (weight[active[i]] < weight[active[b]]) b = i;
+            }
+            weight[nodes] = weight[active[a]] + weight[active[b]];
+            parent[active[a]] = parent[active[b]] = nodes;
+
+            int hi = a > b ? a : b, lo = a > b ? b : a;
+            active[hi] = active[--activeCount];
+            active[lo] = nodes++;
+        }
+
+        int root = nodes - 1, maxDepth = 0;
+        for (int i = 0; i < used; i++) {
+            int depth = 0;
+            for (int node = i; node != root; node = parent[node]) depth++;
+            lengths[symbols[i]] = (unsigned char)depth;
+            if (depth > maxDepth) maxDepth = depth;
+        }
+        if (maxDepth <= limit) return;
+
+        for (int i = 0; i < used; i++) weight[i] = (weight[i] + 1) / 2 + 1;
+    }
+}
+
+// Canonical codes for the given lengths, bit-reversed for the LSB-first writer
+static void zCanonicalCodes(const unsigned char *lengths, int n, uint16_t *codes) {
+    int count[16] = { 0 }, next[16];
+    int code = 0;
+
+    for (int i = 0; i < n; i++) count[lengths[i]]++;
+    count[0] = 0;
+    for (int len = 1; len < 16; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        int len = lengths[i];
+        if (len == 0) continue;
+        int c = next[len]++, reversed = 0;
+        for (int b = 0; b < len; b++) reversed |= ((c >> b) & 1) << (len - 1 - b);
+        codes[i] = (uint16_t)reversed;
+    }
+}
+
+// Run-length codes (16 / 17 / 18) for the code length sequence of a dynamic header
+static int zRunLengths(const unsigned char *lengths, int n, uint8_t *symbols, uint8_t *extra) {
+    int count = 0;
+
+    for (int i = 0; i < n;) {
+        int value = lengths[i], run = 1;
+        while (i + run < n && lengths[i + run] == value) run++;
+
+        if (value == 0 && run >= 3) {
+            int r = run > 138 ? 138 : run;
+            symbols[count] = r >= 11 ? 18 : 17;
+            extra[count++] = (uint8_t)(r >= 11 ? r - 11 : r - 3);
+            i += r;
+        } else if (value != 0 && run >= 4) {
+            symbols[count] = (uint8_t)value;
+            extra[count++] = 0;
+            int r = run - 1 > 6 ? 6 : run - 1;
+            symbols[count] = 16;
+            extra[count++] = (uint8_t)(r - 3);
+            i += 1 + r;
+        } else {
+            symbols[count] = (uint8_t)value;
+            extra[count++] = 0;
+            i++;
+        }
+    }
+    return count;
+}
+
+static const uint8_t zCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Writes one block of tokens (covering the input bytes `raw`)
+static void zWriteBlock(struct zwriter *w, const struct ztoken *tokens, int count,
+                        const unsigned char *raw, size_t rawLength, int final) {
+    uint32_t litFreq[286] = { 0 }, distFreq[30] = { 0 };
+    unsigned char litLen[286], distLen[30], fixedLit[288], fixedDist[30];
+    uint16_t litCode[286], distCode[30];
+    size_t extraBits = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].distance == 0) {
+            litFreq[tokens[i].length]++;
+        } else {
+            int lc = zLengthCode(tokens[i].length), dc = zDistCode(tokens[i].distance);
+            litFreq[257 + lc]++;
+            distFreq[dc]++;
+            extraBits += zLengthExtra[lc] + zDistExtra[dc];
+        }
+    }
+    litFreq[256] = 1;
+
+    zHuffmanLengths(litFreq, 286, 15, litLen);
+    zHuffmanLengths(distFreq, 30, 15, distLen);
+    int anyDistance = 0;
+    for (int i = 0; i < 30; i++) anyDistance |= distLen[i];
+    if (!anyDistance) distLen[0] = 1; // the header needs at least one distance code
+
+    // Dynamic header: trimmed code lengths, run-length coded
+    int nLit = 286, nDist = 30;
+    while (nLit > 257 && litLen[nLit - 1] == 0) nLit--;
+    while (nDist > 1 && distLen[nDist - 1] == 0) nDist--;
+
+    unsigned char all[286 + 30];
+    uint8_t rleSymbols[286 + 30], rleExtra[286 + 30];
+    memcpy(all, litLen, nLit);
+    memcpy(all + nLit, distLen, nDist);
+    int rleCount = zRunLengths(all, nLit + nDist, rleSymbols, rleExtra);
+
+    uint32_t clFreq[19] = { 0 };
+    unsigned char clLen[19];
+    uint16_t clCode[19];
+    for (int i = 0; i < rleCount; i++) clFreq[rleSymbols[i]]++;
+    zHuffmanLengths(clFreq, 19, 7, clLen);
+    int nCl = 19;
+    while (nCl > 4 && clLen[zCodeLengthOrder[nCl - 1]] == 0) nCl--;
+
+    // Costs of the three block types in bits
+    memset(fixedLit, 8, 144);
+    memset(fixedLit + 144, 9, 112);
+    memset(fixedLit + 256, 7, 24);
+    memset(fixedLit + 280, 8, 8);
+    memset(fixedDist, 5, 30);
+
+    size_t dynamicBits = 3 + 14 + 3 * (size_t)nCl + extraBits, fixedBits = 3 + extraBits;
+    for (int i = 0; i < rleCount; i++) {
+        dynamicBits += clLen[rleSymbols[i]] + (rleSymbols[i] == 16 ? 2 : rleSymbols[i] == 17 ? 3 : rleSymbols[i] == 18 ? 7 : 0);
+    }
+    for (int i = 0; i < 286; i++) {
+        dynamicBits += (size_t)litFreq[i] * litLen[i];
+        fixedBits += (size_t)litFreq[i] * fixedLit[i];
+    }
+    for (int i = 0; i < 30; i++) {
+        dynamicBits += (size_t)distFreq[i] * distLen[i];
+        fixedBits += (size_t)distFreq[i] * fixedDist[i];
+    }
+    size_t storedBits = (rawLength + 5 * ((rawLength + 65534) / 65535 + 1)) * 8;
+
+    if (storedBits < dynamicBits && storedBits < fixedBits) {
+        size_t pos = 0;
+        do {
+            size_t n = rawLength - pos > 65535 ? 65535 : rawLength - pos;
+            zwBits(w, final && pos + n == rawLength, 1);
+            zwBits(w, 0, 2);
+            zwAlign(w);
+            zwBits(w, (uint32_t)n, 16);
+            zwBits(w, (uint32_t)n ^ 0xFFFF, 16);
+            for (size_t i = 0; i < n; i++) zwByte(w, raw[pos + i]);
+            pos += n;
+        } while (pos < rawLength);
+        return;
+    }
+
+    const unsigned char *useLit = litLen, *useDist = distLen;
+    zwBits(w, final, 1);
+    if (fixedBits <= dynamicBits) {
+        zwBits(w, 1, 2);
+        useLit = fixedLit;
+        useDist = fixedDist;
+        uint16_t fixedLitCode[288];
+        zCanonicalCodes(fixedLit, 288, fixedLitCode);
+        memcpy(litCode, fixedLitCode, sizeof(litCode));
+    } else {
+        zwBits(w, 2, 2);
+        zwBits(w, nLit - 257, 5);
+        zwBits(w, nDist - 1, 5);
+        zwBits(w, nCl - 4, 4);
+        for (int i = 0; i < nCl; i++) zwBits(w, clLen[zCodeLengthOrder[i]], 3);
+
+        zCanonicalCodes(clLen, 19, clCode);
+        for (int i = 0; i < rleCount; i++) {
+            int s = rleSymbols[i];
+            zwBits(w, clCode[s], clLen[s]);
+            if (s == 16) zwBits(w, rleExtra[i], 2);
+            else if (s == 17) zwBits(w, rleExtra[i], 3);
+            else if (s == 18) zwBits(w, rleExtra[i], 7);
+        }
+        zCanonicalCodes(litLen, 286, litCode);
+    }
+    zCanonicalCodes(useDist, 30, distCode);
+
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].distance == 0) {
+            zwBits(w, litCode[tokens[i].length], useLit[tokens[i].length]);
+            continue;
+        }
+        int length = tokens[i].length, distance = tokens[i].distance;
+        int lc = zLengthCode(length), dc = zDistCode(distance);
+        zwBits(w, litCode[257 + lc], useLit[257 + lc]);
+        if (zLengthExtra[lc]) zwBits(w, length - zLengthBase[lc], zLengthExtra[lc]);
+        zwBits(w, distCode[dc], useDist[dc]);
+        if (zDistExtra[dc]) zwBits(w, distance - zDistBase[dc], zDistExtra[dc]);
+    }
+    zwBits(w, litCode[256], useLit[256]);
+}
+
+// zlib stream header (32K window, default compression)
+void deflateHeader(struct zwriter *w) {
+    zwByte(w, 0x78);
+    zwByte(w, 0x9C);
+}
+
+// ------------------------------------------------------------
+// Function: deflateRange
+// Purpose : Compresses data[start, end) into w as raw deflate
+//           blocks; up to 32 KB before start are used as history
+//           (size = length of the whole buffer)
+// Method  : final = 1 ends the stream, otherwise the range ends
+//           with a sync flush (empty stored block), so the next
+//           range's output can be appended directly
+// Returns : 0 on success, -1 if out of memory
+// ------------------------------------------------------------
+int deflateRange(const unsigned char *data, size_t start, size_t end, size_t size,
+                 int level, int final, struct zwriter *w) {
+    if (level < 0) level = 0;
+    if (level > 9) level = 9;
+
+    struct zmatcher m = { 0 };
+    struct ztoken *tokens = malloc(ZBLOCK_TOKENS * sizeof(*tokens));
+    m.data = data;
+    m.base = start > ZWINDOW_SIZE ? start - ZWINDOW_SIZE : 0;
+    m.end = end;
+    m.hashed = m.base;
+    m.hashLimit = size >= ZMIN_MATCH ? size - ZMIN_MATCH + 1 : 0;
+    m.chain = zLevels[level].chain;
+    m.nice = zLevels[level].nice;
+    if (m.hashLimit > end) m.hashLimit = end;
+    m.head = calloc((size_t)1 << ZHASH_BITS, sizeof(int32_t));
+    m.prev = malloc((end - m.base + 1) * sizeof(int32_t));
+
+    if (!tokens || !m.head || !m.prev) {
+        free(tokens);
+        free(m.head);
+        free(m.prev);
+        return -1;
+    }
+
+    size_t pos = start, blockStart = start;
+    int count = 0, length = 0, distance = 0;
+    int cached = 0, cachedLength = 0, cachedDistance = 0;
+    int lazy = zLevels[level].lazy;
+
+    while (pos < end) {
+        if (cached) {
+            length = cachedLength;
+            distance = cachedDistance;
+            cached = 0;
+        } else if (level > 0) {
+            length = zFindMatch(&m, pos, &distance);
+        }
+
+        // lazy evaluation: if a longer match starts one byte later,
+        // emit a literal now and take that match next
+        if (length > 0 && length < lazy && pos + 1 < end) {
+            cachedLength = zFindMatch(&m, pos + 1, &cachedDistance);
+            if (cachedLength > length) {
+                length = 0;
+                cached = 1;
+            }
+        }
+
+        if (length > 0) {
+            tokens[count++] = (struct ztoken){ (uint16_t)length, (uint16_t)distance };
+            pos += length;
+        } else {
+            tokens[count++] = (struct ztoken){ data[pos], 0 };
+            pos++;
+        }
+
+        if (count == ZBLOCK_TOKENS || (level == 0 && pos - blockStart >= 65535) || pos >= end) {
+            zWriteBlock(w, tokens, count, data + blockStart, pos - blockStart, final && pos >= end);
+            blockStart = pos;
+            count = 0;
+        }
+    }
+
+    if (start == end && final) zWriteBlock(w, NULL, 0, data + start, 0, 1);
+    if (!final) {
+        // sync flush: empty stored block
+        zwBits(w, 0, 3);
+        zwAlign(w);
+        zwBits(w, 0x0000, 16);
+        zwBits(w, 0xFFFF, 16);
+    }
+    zwAlign(w);
+
+    free(tokens);
+    free(m.head);
+    free(m.prev);
+    return w->failed ? -1 : 0;
+}